@@ -0,0 +1,63 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include "engine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+// -----------------------------------------------------------------------------
+// Polyglot opening book, memory-mapped and searched in place
+// -----------------------------------------------------------------------------
+
+// A .bin book is an array of 16-byte big-endian entries sorted by key:
+//   uint64 key, uint16 move, uint16 weight, uint32 learn
+// Moves pack to file, to rank, from file, from rank and promotion (1=n ..
+// 4=q) in 3 bits each, lowest first; castling is written as the king taking
+// its own rook. The file is mapped read-only as is, so engines on one host
+// share one page-cache copy and a lookup is a binary search over the map.
+//
+// Keys are Polyglot's Zobrist hash over its fixed Random64 table (768
+// piece-square, 4 castling, 8 en-passant file, 1 side to move), built into
+// book.cc. The key is computed from the board when probing rather than
+// kept up to date in doMove: the book is probed once per `go`, and
+// maintaining a second hash would cost every node of the search.
+
+class Book {
+public:
+    static constexpr size_t EntrySize = 16;
+    static constexpr uint64_t StartKey = 0x463B96181691FC9CULL; // Polyglot key of startpos
+
+    Book();
+    ~Book();
+    Book(const Book &) = delete;
+    Book &operator=(const Book &) = delete;
+
+    // Map path read-only; on failure the previous book, if any, is kept and
+    // error says why.
+    bool load(const std::string &path, std::string &error);
+    void unload();
+
+    bool loaded() const { return base != nullptr; }
+    const std::string &path() const { return file; }
+    size_t size() const { return count; }
+
+    // Polyglot key of pos.
+    static uint64_t key(const Position &pos);
+
+    // A legal book move for pos, drawn with probability proportional to
+    // its weight, or a none move when the book has nothing playable here.
+    Move probe(const Position &pos, std::mt19937 &rng) const;
+
+private:
+    void *base = nullptr;
+    size_t bytes = 0;
+    size_t count = 0;
+    std::string file;
+};
+
+extern Book BOOK;
+
+#endif // BOOK_H
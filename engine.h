@@ -5,30 +5,161 @@
 #include <atomic>
 #include <cstdint>
 #include <fstream>
+#include <iosfwd>
 #include <sstream>
 #include <string>
 #include <vector>
 
-// Global variable to store position hashes for threefold repetition.
-extern std::vector<uint64_t> gameHashes;
+#ifdef USE_PEXT
+#include <immintrin.h>
+#endif
+
+using Bitboard = uint64_t;
+
+constexpr Bitboard FileABB = 0x0101010101010101ULL;
+constexpr Bitboard FileHBB = 0x8080808080808080ULL;
+constexpr Bitboard Rank1BB = 0x00000000000000FFULL;
+constexpr Bitboard Rank8BB = 0xFF00000000000000ULL;
+
+// -----------------------------------------------------------------------------
+// Leaper attack tables
+// -----------------------------------------------------------------------------
+
+extern Bitboard KnightAttacks[64];
+extern Bitboard KingAttacks[64];
+extern Bitboard PawnAttacks[2][64]; // [side][square], squares attacked by that side's pawn
+
+// -----------------------------------------------------------------------------
+// Slider attack tables
+// -----------------------------------------------------------------------------
+
+// Per-square lookup into the shared bishop/rook attack tables. The index is
+// computed with a magic multiply by default, or with PEXT when built with
+// USE_PEXT on BMI2 hardware; both address the same table layout.
+struct Magic {
+    Bitboard mask = 0;
+    Bitboard magic = 0;
+    Bitboard *attacks = nullptr;
+    unsigned shift = 0;
+
+    unsigned index(Bitboard occ) const {
+#ifdef USE_PEXT
+        return static_cast<unsigned>(_pext_u64(occ, mask));
+#else
+        return static_cast<unsigned>(((occ & mask) * magic) >> shift);
+#endif
+    }
+};
+
+extern Magic BishopMagics[64];
+extern Magic RookMagics[64];
+
+inline Bitboard bishopAttacks(int sq, Bitboard occ) {
+    const Magic &m = BishopMagics[sq];
+    return m.attacks[m.index(occ)];
+}
+
+inline Bitboard rookAttacks(int sq, Bitboard occ) {
+    const Magic &m = RookMagics[sq];
+    return m.attacks[m.index(occ)];
+}
+
+inline Bitboard queenAttacks(int sq, Bitboard occ) {
+    return bishopAttacks(sq, occ) | rookAttacks(sq, occ);
+}
+
+// Squares strictly between two aligned squares, and the full line through
+// them (both empty when the squares share no rank, file or diagonal).
+extern Bitboard BetweenBB[64][64];
+extern Bitboard LineBB[64][64];
 
 // -----------------------------------------------------------------------------
 // CHESS DATA STRUCTURES
 // -----------------------------------------------------------------------------
 
+// Packed 16-bit move: bits 0-5 from, 6-11 to, 12-13 promotion piece
+// (0=n, 1=b, 2=r, 3=q), bit 14 promotion flag, bit 15 capture flag.
+// A default-constructed (zero) move is "no move".
 struct Move {
-    int from;
-    int to;
-    int promotion; // -1 = none, 1=n,2=b,3=r,4=q
+    static constexpr uint16_t PromotionFlag = 1 << 14;
+    static constexpr uint16_t CaptureFlag = 1 << 15;
+
+    uint16_t data;
 
-    Move(int f, int t, int p = -1) : from(f), to(t), promotion(p) {}
-    Move() : from(-1), to(-1), promotion(-1) {}
+    Move() = default;
+    constexpr Move(int f, int t, int p = -1, bool capture = false)
+        : data(static_cast<uint16_t>(f | (t << 6)
+                                     | (p > 0 ? ((p - 1) << 12) | PromotionFlag : 0)
+                                     | (capture ? CaptureFlag : 0))) {}
+
+    constexpr int from() const { return data & 63; }
+    constexpr int to() const { return (data >> 6) & 63; }
+    // -1 = none, 1=n,2=b,3=r,4=q
+    constexpr int promotion() const { return (data & PromotionFlag) ? ((data >> 12) & 3) + 1 : -1; }
+    constexpr bool isPromotion() const { return (data & PromotionFlag) != 0; }
+    constexpr bool isCapture() const { return (data & CaptureFlag) != 0; }
+    constexpr bool isNone() const { return data == 0; }
+
+    constexpr bool operator==(Move o) const { return data == o.data; }
+    constexpr bool operator!=(Move o) const { return data != o.data; }
+};
+
+static_assert(sizeof(Move) == 2, "Move must stay packed in 16 bits");
+
+// Fixed-capacity, stack-allocated move list. 256 exceeds the maximum
+// number of legal moves in any chess position.
+struct MoveList {
+    static constexpr int Capacity = 256;
+
+    Move moves[Capacity];
+    int count = 0;
+
+    void push(Move m) { moves[count++] = m; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+
+    Move &operator[](int i) { return moves[i]; }
+    const Move &operator[](int i) const { return moves[i]; }
+    Move *begin() { return moves; }
+    Move *end() { return moves + count; }
+    const Move *begin() const { return moves; }
+    const Move *end() const { return moves + count; }
+};
+
+// Midgame/endgame pair in centipawns.
+struct Score {
+    int mg = 0;
+    int eg = 0;
+};
+
+// Undo information for Position::doMove, kept on a ply-indexed stack by the
+// search so making and unmaking a move never copies the Position.
+struct StateInfo {
+    int moved;    // piece index that moved, -1 if the from-square was empty
+    int captured; // piece index captured on the to-square, -1 if none
+    Move move;
+    uint64_t hash;
+    int castling;
+    int epSquare;
+    int rule50;
+    Score psq;
+    int phase;
+};
+
+// Legality context computed once per node by Position::checkInfo().
+struct CheckInfo {
+    int kingSquare = -1;     // -1 when the side to move has no king
+    Bitboard checkers = 0;   // enemy pieces giving check
+    Bitboard pinned = 0;     // our pieces pinned to our king
+    Bitboard kingDanger = 0; // squares our king may not step to
+    Bitboard evasions = ~0ULL; // non-king moves must land here
 };
 
 class Position {
 public:
-    using Bitboard = uint64_t;
-    enum Piece { P, N, B, R, Q, K, p, n, b, r, q, k };
+    using Bitboard = ::Bitboard;
+    enum Piece { P, N, B, R, Q, K, p, n, b, r, q, k, NO_PIECE };
 
     std::array<Bitboard, 12> pieces{};
     Bitboard wOcc = 0;
@@ -36,47 +167,120 @@ public:
     Bitboard allOcc = 0;
     int side = 0; // 0 for white, 1 for black
 
+    // Piece index on each square (NO_PIECE when empty), kept in step with
+    // pieces[] so "what is on this square" is a single load.
+    std::array<uint8_t, 64> board{};
+
+    // Castling rights (WhiteOO | WhiteOOO | BlackOO | BlackOOO) and the
+    // en-passant target square (-1 if none). Move generation does not play
+    // castling or en-passant; both are tracked so the hash is faithful.
+    enum CastlingRight { WhiteOO = 1, WhiteOOO = 2, BlackOO = 4, BlackOOO = 8 };
+    int castling = 0;
+    int epSquare = -1;
+
+    // Plies since the last capture or pawn move (the FEN halfmove clock).
+    int rule50 = 0;
+
+    // Zobrist hash, updated incrementally by doMove.
+    uint64_t hash = 0;
+
+    // Material plus piece-square score (white minus black) and game phase
+    // (24 with all minor and major pieces on), updated incrementally by
+    // doMove so the evaluation only has to taper them.
+    static constexpr int MaxPhase = 24;
+    Score psq;
+    int phase = 0;
+
+    // Builds the precomputed attack tables; call once before using any Position.
+    static void init();
+
     // Constructors and basic methods.
     Position();
     static Position create_start_position();
+    void rebuildState(); // recompute occupancies, mailbox, hash and psq from pieces[]
+    int pieceOn(int sq) const { return board[sq]; }
+    bool isConsistent() const; // mailbox, hash and psq agree with the bitboards (debug checks)
     Position rotate() const;
     static Bitboard flip(Bitboard bb);
 
-    // Move generation and game state methods.
-    std::vector<Move> genMoves() const;
-    void generateSlidingMoves(std::vector<Move>& moves, int pieceIdx, const int dir[][2], int numDirections) const;
-    void generateKnightMoves(std::vector<Move>& moves) const;
-    void generateKingMoves(std::vector<Move>& moves) const;
-    void generatePawnMoves(std::vector<Move>& moves) const;
-    Position makeMove(const Move &m) const;
+    // Move generation and game state methods. genMoves() emits legal moves
+    // directly from the node's CheckInfo; isLegal() validates a single move
+    // of unknown origin (TT, ordering) without generating the list.
+    MoveList genMoves() const;
+    // The same legal moves split in two: captures and promotions, then the
+    // rest, so a search can stop before it needs the quiet moves.
+    enum GenType { GenAll, GenCaptures, GenQuiets };
+    MoveList genCaptures() const;
+    MoveList genQuiets() const;
+    bool isLegal(Move m) const;
+    bool hasAnyLegalMove() const;
+    CheckInfo checkInfo() const;
+    Bitboard attackersTo(int sq, Bitboard occ) const;
+    Bitboard attackedBy(int color, Bitboard occ) const;
+    int see(Move m) const;
+    void doMove(Move m, StateInfo &st);
+    void undoMove(Move m, const StateInfo &st);
+    Position makeMove(Move m) const; // copy-make convenience wrapper around doMove
     std::string to_string() const;
 
     // Game state checks.
     bool is_checkmate() const;
     bool is_stalemate() const;
-    bool is_threefold_repetition() const;
     bool isInsufficientMaterial() const;
     std::string current_turn() const;
     bool is_in_check() const;
 
     // Zobrist hash for the position.
-    uint64_t getZobristHash() const;
+    uint64_t getZobristHash() const { return hash; }
+    uint64_t computeHash() const;
+
+    // Full recomputation of psq and phase from pieces[].
+    Score computePsq(int &phaseOut) const;
 
     // Parse a FEN string and return the corresponding Position.
     static Position fromFEN(const std::string &fen);
 
-    // Directional arrays.
+    // Directional arrays (used to build the slider attack tables).
     static const int bishopDir[4][2];
     static const int rookDir[4][2];
     static const int queenDir[8][2];
+
+private:
+    // Bodies of the methods above for side to move Us (the side that moved,
+    // for undoMove), defined in position.cc. The public versions dispatch on
+    // side once, so colour is a compile-time constant below them.
+    template <int Us, GenType Type> MoveList genMoves() const;
+    template <int Us, GenType Type> Bitboard genTargets() const;
+    template <int Us> bool isLegal(Move m) const;
+    template <int Us> bool hasAnyLegalMove() const;
+    template <int Us> CheckInfo checkInfo() const;
+    template <int Us> bool isInCheck() const;
+    template <int Color> Bitboard attackedBy(Bitboard occ) const;
+    template <int Us, GenType Type> void generateSlidingMoves(MoveList& moves, int pieceType, const CheckInfo& ci) const;
+    template <int Us, GenType Type> void generateKnightMoves(MoveList& moves, const CheckInfo& ci) const;
+    template <int Us, GenType Type> void generateKingMoves(MoveList& moves, const CheckInfo& ci) const;
+    template <int Us, GenType Type> void generatePawnMoves(MoveList& moves, const CheckInfo& ci) const;
+    template <int Us> void doMove(Move m, StateInfo &st);
+    template <int Us> void undoMove(Move m, const StateInfo &st);
 };
 
+// -----------------------------------------------------------------------------
+// Perft: legal move path enumeration, to verify and time move generation
+// -----------------------------------------------------------------------------
+
+uint64_t perft(Position &pos, int depth);
+
+// Count leaf nodes at depth, splitting root moves over threads and caching
+// subtree counts in a hashMB-sized table (0 disables it). With divide, the
+// count below each root move is printed as well.
+void perftCommand(const Position &root, int depth, bool divide, int threads, size_t hashMB, std::ostream &out);
+
 // -----------------------------------------------------------------------------
 // Utility: move conversion
 // -----------------------------------------------------------------------------
 
-inline std::string move_to_uci(const Move &m) {
-    if (m.from < 0 || m.to < 0) return "0000";
+inline std::string move_to_uci(Move m) {
+    if (m.isNone()) return "0000";
 
     auto sq_to_str = [](int sq) -> std::string {
         char file = static_cast<char>('a' + (sq % 8));
@@ -84,11 +288,11 @@ inline std::string move_to_uci(const Move &m) {
         return std::string{file, rank};
     };
 
-    std::string uci = sq_to_str(m.from) + sq_to_str(m.to);
+    std::string uci = sq_to_str(m.from()) + sq_to_str(m.to());
 
-    if (m.promotion != -1) {
+    if (m.isPromotion()) {
         char prom = 'q';
-        switch (m.promotion) {
+        switch (m.promotion()) {
             case 1: prom = 'n'; break;
             case 2: prom = 'b'; break;
             case 3: prom = 'r'; break;
@@ -1,146 +1,1063 @@
 // fuzzymax.cc
+#include "book.h"
 #include "engine.h"
+#include "nnue.h"
+#include "tt.h"
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <random>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
-// Define the global gameHashes variable.
-std::vector<uint64_t> gameHashes;
-
 static bool use_bandit_search = false;
+static bool use_mcts = false;
+// Play from the Polyglot book (BookFile) while it has a move.
+static bool own_book = false;
+// SMTS pruning tolerance: a child is abandoned once its softmax weight is
+// provably below this fraction of the best sibling's. 0 disables pruning.
+static double smts_tolerance = 0.0;
+// SMTS inverse temperature: child values are weighted by exp(beta * value),
+// so larger values sharpen the softmax towards plain max.
+static double smts_beta = 1.0;
 static int MaxDepth = 25;
+// UCI `debug on`: each iteration also prints the search counters.
+static bool debug_mode = false;
 static std::atomic<bool> stop_search{false};
 
-static std::vector<Move> getMoves(const Position* pos) {
-    return pos->genMoves();
-}
+static constexpr int MAX_PLY = 128;
+// Halfmove clock at which the game is drawn by the 50-move rule. No
+// position further back than this can be repeated before the draw.
+static constexpr int Rule50Plies = 100;
+
+// A root move and what the latest iteration to search it learned. Kept
+// across iterations so each one searches the root best-first.
+struct RootMove {
+    Move move;
+    double value = -std::numeric_limits<double>::infinity();
+    uint64_t nodes = 0;
+};
+
+// Diagnostic counters, printed per iteration under `debug on`. Build with
+// `make STATS=0` to compile them out; nodes and seldepth are always kept,
+// time management and the info lines need them.
+#ifdef NO_SEARCH_STATS
+static constexpr bool CollectStats = false;
+#else
+static constexpr bool CollectStats = true;
+#endif
+
+struct SearchStats {
+    enum Counter {
+        Evals,          // static evaluations, including batched ones
+        MoveGens,       // move list generations (full, captures or quiets)
+        TTProbes,
+        TTHits,
+        IllegalTTMoves, // hits whose move is not legal here (key collisions)
+        BanditPlayouts, // MABS arm playouts
+        CounterCount
+    };
+
+    // Written only by the owning thread; atomic so the reporting thread can
+    // sum them while the search runs.
+    std::atomic<uint64_t> values[CounterCount] = {};
+
+    void add(Counter c, uint64_t n = 1) {
+        if constexpr (CollectStats) {
+            values[c].store(values[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    }
+    uint64_t get(Counter c) const { return values[c].load(std::memory_order_relaxed); }
+    void clear() {
+        for (auto &v : values) v.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Bump allocator for the per-node scratch of the recursive searches, used
+// as a stack: a node takes a mark on entry, allocates what it needs for its
+// children and rewinds to the mark before returning. Blocks are kept once
+// allocated, so after the first search or two nothing reaches the heap.
+// Only for trivially destructible types; memory comes back uninitialised.
+class ScratchArena {
+public:
+    static constexpr size_t BlockSize = 1 << 20;
+    static constexpr size_t Alignment = 64; // blocks start here: enough for NNUE accumulators
+
+    struct Mark {
+        size_t block;
+        size_t used;
+        size_t base;
+    };
+
+    Mark mark() const { return {current, used, base}; }
+    void rewind(const Mark &m) {
+        current = m.block;
+        used = m.used;
+        base = m.base;
+    }
+
+    // Release everything and start a new peak; called at the start of each
+    // search.
+    void reset() {
+        current = used = base = peak = 0;
+    }
 
-// Material-only evaluation in centipawns (positive = good for side to move).
-static int evaluate(const Position* pos) {
-    // White: P N B R Q K, Black: p n b r q k
-    static constexpr std::array<int, 12> pieceValues = {
-        100, 320, 330, 500, 900, 20000,
-        -100, -320, -330, -500, -900, -20000
+    // Most bytes in use at once since the last reset, counting the unused
+    // tail of any block an allocation did not fit in.
+    size_t peakBytes() const { return peak; }
+
+    template <typename T>
+    T *alloc(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        static_assert(alignof(T) <= Alignment, "over-aligned type");
+        const size_t bytes = count * sizeof(T);
+        size_t offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (blocks.empty() || offset + bytes > blocks[current].size) {
+            // Everything in the blocks past current is free, so the next one
+            // can be replaced if it is too small.
+            const size_t next = blocks.empty() ? 0 : current + 1;
+            if (!blocks.empty()) base += blocks[current].size;
+            if (next == blocks.size()) blocks.emplace_back();
+            if (blocks[next].size < bytes) {
+                blocks[next].size = std::max(BlockSize, bytes);
+                blocks[next].data.reset(static_cast<unsigned char *>(
+                    ::operator new[](blocks[next].size, std::align_val_t(Alignment))));
+            }
+            current = next;
+            offset = 0;
+        }
+        used = offset + bytes;
+        peak = std::max(peak, base + used);
+        return reinterpret_cast<T *>(blocks[current].data.get() + offset);
+    }
+
+private:
+    struct AlignedDelete {
+        void operator()(unsigned char *p) const { ::operator delete[](p, std::align_val_t(Alignment)); }
     };
+    struct Block {
+        std::unique_ptr<unsigned char[], AlignedDelete> data;
+        size_t size = 0;
+    };
+    std::vector<Block> blocks;
+    size_t current = 0; // block allocations come from
+    size_t used = 0;    // bytes used in it
+    size_t base = 0;    // bytes in the blocks before it
+    size_t peak = 0;
+};
+
+// Per-search state. Anything indexed by ply is preallocated here so the
+// recursive searches can make and unmake moves without allocating.
+struct SearchContext {
+    std::mt19937 rng;
+    // Written only by the owning thread; atomic so the reporting thread can
+    // sum it while the search runs.
+    std::atomic<uint64_t> nodes{0};
+    // Lazy SMP helpers shuffle child order and use their own UCB1
+    // exploration constant, so helpers and main thread fill different parts
+    // of the shared TT.
+    bool helper = false;
+    double explore = 2.0;
+    // The thread whose node count drives the time manager: the main thread
+    // of a UCI or bench search.
+    bool pollTime = true;
+    // Table this context probes and stores into; batch analysis gives each
+    // worker its own.
+    TranspositionTable *tt = &TT;
+    StateInfo states[MAX_PLY];
+
+    // Deepest ply any node of the search has reached.
+    std::atomic<int> seldepth{0};
+    SearchStats stats;
+    // Set on the main thread of a search that prints info lines; currmove
+    // lines are due again at nextCurrmove ms into the search.
+    bool report = false;
+    uint64_t nextCurrmove = 0;
+
+    // Hashes of the positions on the current line, oldest first: the tail
+    // of the game ending with the root at keys[rootKey], then one per
+    // search ply below it.
+    uint64_t keys[Rule50Plies + 1 + MAX_PLY];
+    int rootKey = 0;
+
+    // Triangular PV table: a node at ply leaves its line in pv[ply].
+    Move pv[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY] = {};
+    // Per-node scratch: children's values and lines a node keeps until it
+    // has picked a move (SMTS samples after the last child, MABS keeps each
+    // arm's statistics and best line), and the frontier batch.
+    ScratchArena scratch;
+
+    // Root moves in the order the next iteration searches them.
+    std::vector<RootMove> rootMoves;
+
+    // NNUE accumulator for the position at each ply, valid while its key
+    // matches that position's hash.
+    Accumulator acc[MAX_PLY + 1];
+
+    // game holds the game's positions oldest first, ending with the root.
+    void setGame(const std::vector<uint64_t> &game) {
+        const int n = std::min<int>(static_cast<int>(game.size()), Rule50Plies + 1);
+        std::copy(game.end() - n, game.end(), keys);
+        rootKey = n - 1;
+    }
+
+    void copyGame(const SearchContext &other) {
+        std::copy(other.keys, other.keys + other.rootKey + 1, keys);
+        rootKey = other.rootKey;
+    }
+
+    // Record pos as the position at ply (> 0) and report whether it is a
+    // draw: by the 50-move rule, by repeating a position since the last
+    // capture or pawn move, or for lack of mating material. Only positions
+    // an even number of plies back, at least four, can be the same with the
+    // same side to move.
+    bool isDraw(const Position &pos, int ply) {
+        const int top = rootKey + ply;
+        keys[top] = pos.hash;
+        if (pos.rule50 >= Rule50Plies) return true;
+        const int oldest = std::max(0, top - pos.rule50);
+        for (int i = top - 4; i >= oldest; i -= 2) {
+            if (keys[i] == pos.hash) return true;
+        }
+        const Bitboard heavy = pos.pieces[Position::P] | pos.pieces[Position::R] | pos.pieces[Position::Q]
+                             | pos.pieces[Position::p] | pos.pieces[Position::r] | pos.pieces[Position::q];
+        return !heavy && pos.isInsufficientMaterial();
+    }
+
+    void countNode(int ply) {
+        nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        reachPly(ply);
+    }
+    void reachPly(int ply) {
+        if (ply > seldepth.load(std::memory_order_relaxed)) seldepth.store(ply, std::memory_order_relaxed);
+    }
+
+    // Start the counters of a new search.
+    void resetCounters() {
+        nodes.store(0, std::memory_order_relaxed);
+        seldepth.store(0, std::memory_order_relaxed);
+        stats.clear();
+        nextCurrmove = 0;
+    }
+
+    bool ttProbe(uint64_t key, TTData &tte) {
+        stats.add(SearchStats::TTProbes);
+        if (!tt->probe(key, tte)) return false;
+        stats.add(SearchStats::TTHits);
+        return true;
+    }
+
+    // pv[ply] = m followed by the len moves at rest.
+    void setLine(int ply, Move m, const Move *rest, int len) {
+        pv[ply][0] = m;
+        std::copy(rest, rest + len, pv[ply] + 1);
+        pvLength[ply] = len + 1;
+    }
+
+    std::vector<Move> line(int ply) const { return std::vector<Move>(pv[ply], pv[ply] + pvLength[ply]); }
+
+    // Best value first; among equals, the move that took more effort.
+    void sortRootMoves() {
+        std::stable_sort(rootMoves.begin(), rootMoves.end(), [](const RootMove &a, const RootMove &b) {
+            return a.value > b.value || (a.value == b.value && a.nodes > b.nodes);
+        });
+    }
+
+    void resetAccumulators() {
+        for (Accumulator &a : acc) a.key = 0;
+    }
+
+    MoveList rootMoveList() const {
+        MoveList list;
+        for (const RootMove &rm : rootMoves) list.push(rm.move);
+        return list;
+    }
+
+    void updateRootMove(Move m, double value, uint64_t spent) {
+        for (RootMove &rm : rootMoves) {
+            if (rm.move == m) {
+                rm.value = value;
+                rm.nodes = spent;
+                return;
+            }
+        }
+    }
+};
+
+// Last completed iteration of one search thread.
+struct SearchResult {
+    int depth = 0;
+    double eval = 0.0;
+    std::vector<Move> pv;
+};
+
+static uint64_t get_time_ms() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// -----------------------------------------------------------------------------
+// Time management: limits from `go`, polled from inside the search
+// -----------------------------------------------------------------------------
+
+struct SearchLimits {
+    int time[2] = {0, 0}; // wtime, btime
+    int inc[2] = {0, 0};  // winc, binc
+    int movestogo = 0;
+    int movetime = 0;
+    int depth = 0;
+    int mate = 0;
+    uint64_t nodes = 0;
+    bool infinite = false;
+    bool ponder = false; // the clock only starts at ponderhit
+
+    bool useTimeManagement() const { return time[0] || time[1]; }
+    // True when a clock, a node count or stop ends the search, not depth.
+    bool limited() const { return infinite || ponder || movetime > 0 || useTimeManagement() || nodes > 0; }
+};
+
+static int move_overhead = 10; // ms kept back per move for GUI/network lag
+
+static uint64_t total_nodes(const SearchContext &ctx);
+static void sync_print(const std::string &text);
+
+// The soft limit is checked between iterations: no new depth is started
+// past it. The hard limit and the node limit abort the search. The main
+// thread polls every PollInterval nodes rather than a timer thread waking
+// up on its own schedule.
+//
+// A ponder search runs untimed until the UCI thread reports ponderhit; the
+// search thread then starts the clock on the limits `go ponder` gave, at
+// its next poll, and carries on with the search it has.
+class TimeManager {
+public:
+    static constexpr uint64_t PollInterval = 1024;
+
+    enum PonderState { NotPondering, Pondering, PonderHit };
+
+    void init(const SearchLimits &limits, int side, uint64_t start) {
+        startTime = start;
+        nodeLimit = limits.nodes;
+        softMs = hardMs = 0;
+        timed = false;
+        ponderLimits = limits;
+        ponderSide = side;
+
+        if (limits.infinite || limits.ponder) {
+            // Only stop (or a node limit) ends the search.
+        } else if (limits.movetime > 0) {
+            timed = true;
+            softMs = hardMs = std::max(limits.movetime - move_overhead, 1);
+        } else if (limits.useTimeManagement()) {
+            timed = true;
+            // Sudden death is planned as 30 more moves; movestogo is
+            // trusted but capped so one move never gets a huge slice.
+            const int mtg = limits.movestogo > 0 ? std::min(limits.movestogo, 50) : 30;
+            const int64_t left = std::max<int64_t>(limits.time[side] - move_overhead, 1);
+            const int64_t inc = limits.inc[side];
+            const int64_t cap = std::max<int64_t>(left * 4 / 5, 1);
+            const int64_t soft = left / mtg + inc * 3 / 4;
+            hardMs = std::min(soft * 4, cap);
+            softMs = std::min(soft, hardMs);
+        }
+        nextPoll = nodeLimit ? std::min(nodeLimit, PollInterval) : PollInterval;
+    }
+
+    uint64_t elapsed() const { return get_time_ms() - startTime; }
+
+    // True once the deepening loop should not start another iteration.
+    bool softExpired() {
+        checkPonderhit();
+        return timed && elapsed() >= static_cast<uint64_t>(softMs);
+    }
+
+    // Called by the UCI thread: before a search starts, and on ponderhit or
+    // stop while it runs.
+    void beginSearch(const SearchLimits &limits) {
+        ponder.store(limits.ponder ? Pondering : NotPondering, std::memory_order_relaxed);
+        infinite.store(limits.infinite, std::memory_order_relaxed);
+    }
+    void ponderhit() {
+        int expected = Pondering;
+        ponder.compare_exchange_strong(expected, PonderHit, std::memory_order_relaxed);
+    }
+    void stopRequested() {
+        ponder.store(NotPondering, std::memory_order_relaxed);
+        infinite.store(false, std::memory_order_relaxed);
+    }
+    bool pondering() const { return ponder.load(std::memory_order_relaxed) == Pondering; }
+
+    // A ponder search may not answer before ponderhit or stop, nor an
+    // infinite one before stop, even when it has nothing left to search.
+    bool holdAnswer() const { return pondering() || infinite.load(std::memory_order_relaxed); }
+
+    // Called by the main thread for every node; cheap until the next poll.
+    void update(const SearchContext &ctx) {
+        if (ctx.nodes.load(std::memory_order_relaxed) >= nextPoll) poll(ctx);
+    }
 
-    int scoreWhiteMinusBlack = 0;
-    for (int i = 0; i < 12; i++) {
-        scoreWhiteMinusBlack += pieceValues[i] * __builtin_popcountll(pos->pieces[i]);
+private:
+    void checkPonderhit() {
+        if (ponder.load(std::memory_order_relaxed) != PonderHit) return;
+        ponder.store(NotPondering, std::memory_order_relaxed);
+        SearchLimits limits = ponderLimits;
+        limits.ponder = false;
+        init(limits, ponderSide, get_time_ms());
     }
 
+    void poll(const SearchContext &ctx) {
+        checkPonderhit();
+        const uint64_t own = ctx.nodes.load(std::memory_order_relaxed);
+        uint64_t step = PollInterval;
+        if (nodeLimit) {
+            const uint64_t total = total_nodes(ctx);
+            if (total >= nodeLimit) {
+                stop_search.store(true, std::memory_order_relaxed);
+                return;
+            }
+            step = std::min(step, nodeLimit - total);
+        }
+        if (timed && elapsed() >= static_cast<uint64_t>(hardMs)) {
+            stop_search.store(true, std::memory_order_relaxed);
+            return;
+        }
+        nextPoll = own + step;
+    }
+
+    uint64_t startTime = 0;
+    uint64_t nodeLimit = 0;
+    uint64_t nextPoll = PollInterval;
+    int64_t softMs = 0;
+    int64_t hardMs = 0;
+    bool timed = false;
+    SearchLimits ponderLimits;
+    int ponderSide = 0;
+    std::atomic<int> ponder{NotPondering};
+    std::atomic<bool> infinite{false};
+};
+
+static TimeManager time_man;
+
+// Tapered material + piece-square evaluation in centipawns (positive = good
+// for side to move). Position keeps both halves up to date in doMove, so the
+// leaf only blends them by game phase.
+static int evaluate_psq(const Position* pos) {
+    const int phase = std::min(pos->phase, Position::MaxPhase); // promotions can push it past 24
+    const int scoreWhiteMinusBlack =
+        (pos->psq.mg * phase + pos->psq.eg * (Position::MaxPhase - phase)) / Position::MaxPhase;
+
     // Convert to side-to-move perspective for negamax correctness.
     return (pos->side == 0) ? scoreWhiteMinusBlack : -scoreWhiteMinusBlack;
 }
 
-static double SMTS(const Position* pos, int depth, std::vector<Move>& pv, std::mt19937 &rng) {
-    if (stop_search.load(std::memory_order_relaxed)) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+// Accumulator of pos at ply. It is brought up to date from the nearest
+// ancestor whose accumulator is still valid, replaying only the changed
+// features of the moves in between (ctx.states[i] holds the move played at
+// ply i); with no valid ancestor it is rebuilt from scratch.
+static const Accumulator &accumulator(const Position* pos, SearchContext &ctx, int ply) {
+    Accumulator *acc = ctx.acc;
+    if (acc[ply].key != pos->hash) {
+        int q = ply - 1;
+        while (q >= 0 && acc[q].key != ctx.states[q].hash) q--;
+        if (q < 0) {
+            NNUE.refresh(acc[ply], *pos);
+        } else {
+            for (int i = q; i < ply; i++) {
+                NNUE.update(acc[i], acc[i + 1], ctx.states[i]);
+                acc[i + 1].key = (i + 1 == ply) ? pos->hash : ctx.states[i + 1].hash;
+            }
+        }
+    }
+    return acc[ply];
+}
+
+static int evaluate_nnue(const Position* pos, SearchContext &ctx, int ply) {
+    return NNUE.evaluate(accumulator(pos, ctx, ply), pos->side);
+}
+
+static int evaluate(const Position* pos, SearchContext &ctx, int ply) {
+    ctx.stats.add(SearchStats::Evals);
+    return NNUE.loaded() ? evaluate_nnue(pos, ctx, ply) : evaluate_psq(pos);
+}
+
+// Structure-of-arrays view of a batch of positions: just the inputs the
+// evaluation reads, laid out so scoring is one branch-free loop the compiler
+// vectorises. An evaluator that needs more (bitboards, NNUE accumulators, a
+// remote accelerator) adds its own columns here.
+struct EvalBatch {
+    alignas(64) int mg[MoveList::Capacity];
+    alignas(64) int eg[MoveList::Capacity];
+    alignas(64) int phase[MoveList::Capacity];
+    alignas(64) int sign[MoveList::Capacity];
+    int count = 0;
+
+    void push(const Position &pos) {
+        mg[count] = pos.psq.mg;
+        eg[count] = pos.psq.eg;
+        phase[count] = std::min(pos.phase, Position::MaxPhase);
+        sign[count] = pos.side == 0 ? 1 : -1;
+        count++;
     }
 
-    if (depth == 0) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+    // Same result as evaluate_psq() for each position.
+    void score(int *out) const {
+        for (int i = 0; i < count; i++) {
+            const int blended = (mg[i] * phase[i] + eg[i] * (Position::MaxPhase - phase[i])) / Position::MaxPhase;
+            out[i] = sign[i] * blended;
+        }
     }
+};
 
-    std::vector<Move> moves = getMoves(pos);
-    if (moves.empty()) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+// Score n positions (at most MoveList::Capacity) for their side to move in
+// one call, with the PSQ evaluation.
+static void evaluateBatch(const Position* children, int n, int* out) {
+    EvalBatch batch;
+    for (int i = 0; i < n; i++) {
+        batch.push(children[i]);
+    }
+    batch.score(out);
+}
+
+// -----------------------------------------------------------------------------
+// Softmax kernel: log-sum-exp and sampling over a node's child values
+// -----------------------------------------------------------------------------
+
+// exp(x) for x in [-700, 700] with relative error below 1e-8: 2^n is built
+// directly in the exponent bits and exp(r), |r| <= ln(2) / 2, is a degree-7
+// polynomial. Branch-free, so loops over it vectorise; callers clamp.
+static inline double exp_approx(double x) {
+    constexpr double Log2e = 1.4426950408889634;
+    constexpr double Ln2 = 0.6931471805599453;
+    constexpr double Round = 6755399441055744.0; // 1.5 * 2^52: adding it rounds to an integer
+    const double shifted = x * Log2e + Round;
+    const double n = shifted - Round;
+    const double r = x - n * Ln2;
+
+    double p = 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    // The low mantissa bits of shifted hold n.
+    uint64_t nBits, roundBits;
+    std::memcpy(&nBits, &shifted, sizeof(nBits));
+    std::memcpy(&roundBits, &Round, sizeof(roundBits));
+    const uint64_t scaleBits = (nBits - roundBits + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &scaleBits, sizeof(scale));
+    return p * scale;
+}
+
+static inline double fast_exp(double x) { return exp_approx(std::clamp(x, -700.0, 700.0)); }
+
+// Replace the n >= 1 values at w, whose maximum is max, with their softmax
+// CDF under beta (unnormalised: w[n - 1] is the partition sum) and return
+// their log-sum-exp, max + log(sum exp(beta * (v - max))) / beta. The clamp
+// gets its own pass: folded into the exp loop it stops GCC vectorising it.
+static double softmax_cdf(double *w, int n, double beta, double max) {
+    for (int i = 0; i < n; i++) {
+        w[i] = std::clamp(beta * (w[i] - max), -700.0, 0.0);
+    }
+    for (int i = 0; i < n; i++) {
+        w[i] = exp_approx(w[i]);
     }
+    for (int i = 1; i < n; i++) {
+        w[i] += w[i - 1];
+    }
+    return max + std::log(w[n - 1]) / beta;
+}
 
-    const double beta = 1.0;
+// Inverse-CDF sample: the first index whose CDF reaches u * total, u in [0, 1).
+static int sample_cdf(const double *cdf, int n, double u) {
+    const double *hit = std::lower_bound(cdf, cdf + n, u * cdf[n - 1]);
+    return std::min(static_cast<int>(hit - cdf), n - 1);
+}
 
-    std::vector<double> child_vals;
-    child_vals.reserve(moves.size());
-    std::vector<std::vector<Move>> child_pvs;
-    child_pvs.reserve(moves.size());
+// Look up a stored result at least as deep as requested. Entries hold a
+// single move, so the PV is rebuilt by following stored moves. The root is
+// never cut so every iteration reports a freshly searched line.
+static bool probeTT(Position* pos, int depth, int ply, SearchContext &ctx, double &value) {
+    TTData tte;
+    if (ply == 0 || !ctx.ttProbe(pos->hash, tte) || tte.depth < depth) return false;
+    if (!pos->isLegal(tte.move)) {
+        ctx.stats.add(SearchStats::IllegalTTMoves);
+        return false;
+    }
 
-    for (const auto &move : moves) {
-        Position child = pos->makeMove(move);
-        std::vector<Move> child_pv;
-        double val = -SMTS(&child, depth - 1, child_pv, rng);
-        child_vals.push_back(val);
-        child_pvs.push_back(std::move(child_pv));
+    value = tte.value;
+    Move *pv = ctx.pv[ply];
+
+    int n = 0;
+    while (true) {
+        pv[n] = tte.move;
+        pos->doMove(tte.move, ctx.states[ply + n]);
+        n++;
+        if (n >= depth || ply + n >= MAX_PLY) break;
+        if (!ctx.ttProbe(pos->hash, tte)) break;
+        if (!pos->isLegal(tte.move)) {
+            ctx.stats.add(SearchStats::IllegalTTMoves);
+            break;
+        }
+    }
+    ctx.pvLength[ply] = n;
+    while (n-- > 0) {
+        pos->undoMove(pv[n], ctx.states[ply + n]);
+    }
+    return true;
+}
 
+// Move the TT move (the previous iteration's choice here) to the front and
+// return the first move after it.
+static Move *tt_move_first(const Position *pos, SearchContext &ctx, MoveList &moves) {
+    TTData tte;
+    if (ctx.ttProbe(pos->hash, tte)) {
+        Move *hit = std::find(moves.begin(), moves.end(), tte.move);
+        if (hit != moves.end()) {
+            std::rotate(moves.begin(), hit, hit + 1);
+            return moves.begin() + 1;
+        }
+        ctx.stats.add(SearchStats::IllegalTTMoves);
+    }
+    return moves.begin();
+}
+
+// Plies below the root whose children are put in TT order every iteration.
+static constexpr int NearRootPlies = 2;
+
+// Pruning mode searches the TT move first and captures before quiet moves,
+// so a strong sibling sets a tight bound early.
+static void order_moves(const Position *pos, SearchContext &ctx, MoveList &moves) {
+    Move *first = tt_move_first(pos, ctx, moves);
+    std::stable_partition(first, moves.end(), [](Move m) { return m.isCapture(); });
+}
+
+// Root moves come from the context in last iteration's order; plies just
+// below it get the TT move first.
+static MoveList gen_search_moves(Position *pos, int ply, SearchContext &ctx) {
+    if (ply == 0 && !ctx.rootMoves.empty()) return ctx.rootMoveList();
+    MoveList moves = pos->genMoves();
+    ctx.stats.add(SearchStats::MoveGens);
+    if (ply <= NearRootPlies) tt_move_first(pos, ctx, moves);
+    return moves;
+}
+
+// -----------------------------------------------------------------------------
+// Move picker: TT move, then captures best-first, then quiet moves, each
+// stage generated only once the one before it is used up
+// -----------------------------------------------------------------------------
+
+// MVV-LVA: the most valuable victim first, the least valuable attacker among
+// equals. A promotion counts as winning the promoted piece.
+static int capture_score(const Position *pos, Move m) {
+    static constexpr int Value[6] = {1, 3, 3, 5, 9, 0};
+    int gain = 0;
+    if (m.isCapture()) gain += Value[pos->pieceOn(m.to()) % 6];
+    if (m.isPromotion()) gain += Value[m.promotion()] - 1;
+    return gain * 8 - Value[pos->pieceOn(m.from()) % 6];
+}
+
+class MovePicker {
+public:
+    // Every legal move, ttMove first if it is legal here.
+    MovePicker(const Position *pos, Move ttMove, SearchStats &stats)
+        : pos(pos), stats(&stats), ttMove(ttMove), stage(TTStage) {}
+    // Captures and promotions only, for quiescence.
+    MovePicker(const Position *pos, SearchStats &stats)
+        : pos(pos), stats(&stats), stage(GenCaptureStage), capturesOnly(true) {}
+    // A ready list, in its own order.
+    explicit MovePicker(const MoveList &list) : moves(list), stage(QuietStage) {}
+
+    // The next move, or a none move once every stage is used up.
+    Move next() {
+        while (true) {
+            switch (stage) {
+                case TTStage:
+                    stage = GenCaptureStage;
+                    if (ttMove.isNone()) break;
+                    if (pos->isLegal(ttMove)) return ttMove;
+                    stats->add(SearchStats::IllegalTTMoves);
+                    break;
+                case GenCaptureStage:
+                    moves = pos->genCaptures();
+                    stats->add(SearchStats::MoveGens);
+                    for (int i = 0; i < moves.size(); i++) {
+                        scores[i] = capture_score(pos, moves[i]);
+                    }
+                    cur = 0;
+                    stage = CaptureStage;
+                    break;
+                case CaptureStage:
+                    // Selection sort, one step per move taken: a node cut
+                    // after a few captures never orders the rest.
+                    while (cur < moves.size()) {
+                        int best = cur;
+                        for (int i = cur + 1; i < moves.size(); i++) {
+                            if (scores[i] > scores[best]) best = i;
+                        }
+                        std::swap(moves[cur], moves[best]);
+                        std::swap(scores[cur], scores[best]);
+                        const Move m = moves[cur++];
+                        if (m != ttMove) return m;
+                    }
+                    stage = capturesOnly ? DoneStage : GenQuietStage;
+                    break;
+                case GenQuietStage:
+                    moves = pos->genQuiets();
+                    stats->add(SearchStats::MoveGens);
+                    cur = 0;
+                    stage = QuietStage;
+                    break;
+                case QuietStage:
+                    while (cur < moves.size()) {
+                        const Move m = moves[cur++];
+                        if (m != ttMove) return m;
+                    }
+                    stage = DoneStage;
+                    break;
+                case DoneStage:
+                    return Move();
+            }
+        }
+    }
+
+private:
+    enum Stage { TTStage, GenCaptureStage, CaptureStage, GenQuietStage, QuietStage, DoneStage };
+
+    const Position *pos = nullptr;
+    SearchStats *stats = nullptr;
+    Move ttMove{};
+    MoveList moves;
+    int scores[MoveList::Capacity];
+    int cur = 0;
+    Stage stage;
+    bool capturesOnly = false;
+};
+
+static Move tt_move(const Position *pos, SearchContext &ctx) {
+    TTData tte;
+    return ctx.ttProbe(pos->hash, tte) ? tte.move : Move();
+}
+
+// -----------------------------------------------------------------------------
+// Quiescence: leaves are scored once the captures worth making are made
+// -----------------------------------------------------------------------------
+
+// Alpha-beta over the captures and promotions that win material in the
+// exchange, with the static evaluation standPat as the floor the side to
+// move can always take. Even exchanges are skipped as well: they leave the
+// balance where the stand pat has it, and with every leaf searched on a full
+// window they would be most of the cost. Checks are not resolved; there is
+// no mate score for them to find.
+static double qsearch(Position *pos, int ply, SearchContext &ctx, double alpha, double beta, int standPat) {
+    ctx.pvLength[ply] = 0;
+    if (standPat >= beta || ply >= MAX_PLY - 1) return standPat;
+    alpha = std::max(alpha, static_cast<double>(standPat));
+
+    MovePicker picker(pos, ctx.stats);
+    double best = standPat;
+    StateInfo &st = ctx.states[ply];
+    Move m;
+    while (!(m = picker.next()).isNone()) {
+        if (pos->see(m) <= 0) continue;
+
+        ctx.countNode(ply + 1);
+        if (ctx.pollTime) time_man.update(ctx);
+        pos->doMove(m, st);
+        const double val = -qsearch(pos, ply + 1, ctx, -beta, -alpha, evaluate(pos, ctx, ply + 1));
+        pos->undoMove(m, st);
+
+        if (val > best) {
+            best = val;
+            alpha = std::max(alpha, val);
+            if (alpha >= beta) break;
+        }
         if (stop_search.load(std::memory_order_relaxed)) break;
     }
+    return best;
+}
+
+static double quiesce(Position *pos, int ply, SearchContext &ctx) {
+    const double inf = std::numeric_limits<double>::infinity();
+    return qsearch(pos, ply, ctx, -inf, inf, evaluate(pos, ctx, ply));
+}
 
-    // If we were interrupted mid-loop, fall back to best-so-far.
-    if (child_vals.empty()) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+// currmove lines start once a search has run CurrmoveDelay ms, and then come
+// at most one per CurrmoveInterval ms, so short searches print none.
+static constexpr uint64_t CurrmoveDelay = 1000;
+static constexpr uint64_t CurrmoveInterval = 200;
+
+// Called as a root move is about to be searched.
+static void report_currmove(SearchContext &ctx, int depth, Move m, int number) {
+    if (!ctx.report) return;
+    const uint64_t elapsed = time_man.elapsed();
+    if (elapsed < std::max(CurrmoveDelay, ctx.nextCurrmove)) return;
+    ctx.nextCurrmove = elapsed + CurrmoveInterval;
+    sync_print("info depth " + std::to_string(depth) + " currmove " + move_to_uci(m)
+               + " currmovenumber " + std::to_string(number) + "\n");
+}
+
+// bound: the caller no longer needs this node's exact value once it is known
+// to be at least bound. The value is a log-sum-exp, so it never falls below
+// the running log-sum-exp of the children searched so far; once that reaches
+// bound the node returns it early (and does not store it in the TT).
+static double SMTS(Position* pos, int depth, int ply, SearchContext &ctx,
+                   double bound = std::numeric_limits<double>::infinity()) {
+    ctx.countNode(ply);
+    if (ctx.pollTime) time_man.update(ctx);
+    if (stop_search.load(std::memory_order_relaxed)) {
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
     }
 
-    double max_val = *std::max_element(child_vals.begin(), child_vals.end());
-    double total_weight = 0.0;
+    // The last ply of the stacks is a leaf, so no child indexes past them.
+    if (ply >= MAX_PLY - 1) {
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
+    }
 
-    std::vector<double> weights;
-    weights.reserve(child_vals.size());
+    if (ply > 0 && ctx.isDraw(*pos, ply)) {
+        ctx.pvLength[ply] = 0;
+        return 0.0;
+    }
+    if (depth == 0) return quiesce(pos, ply, ctx);
 
-    for (double val : child_vals) {
-        double w = std::exp(beta * (val - max_val));
-        weights.push_back(w);
-        total_weight += w;
+    double ttValue;
+    if (probeTT(pos, depth, ply, ctx, ttValue)) {
+        return ttValue;
     }
 
-    std::uniform_real_distribution<double> dist(0.0, total_weight);
-    double r = dist(rng);
+    const double tolerance = smts_tolerance;
+    const bool prune = tolerance > 0.0;
+    const double logTolerance = prune ? std::log(tolerance) : 0.0;
+
+    // Pruning on the main thread below the root takes moves from a staged
+    // picker, so a node cut after its TT move or captures never generates
+    // its quiet moves. Otherwise every move is needed (or shuffled) anyway.
+    const bool staged = prune && ply > 0 && !ctx.helper;
+    MoveList moves; // all moves up front, or those picked so far when staged
+    if (!staged) {
+        moves = gen_search_moves(pos, ply, ctx);
+        if (moves.empty()) {
+            ctx.pvLength[ply] = 0;
+            return static_cast<double>(evaluate(pos, ctx, ply));
+        }
+        if (ctx.helper) {
+            std::shuffle(moves.begin(), moves.end(), ctx.rng);
+        }
+        // The root list is ordered between iterations already.
+        if (prune && ply > 0) {
+            order_moves(pos, ctx, moves);
+        }
+    }
 
-    double accum = 0.0;
-    size_t chosen_index = 0;
-    for (size_t i = 0; i < weights.size(); i++) {
-        accum += weights[i];
-        if (accum >= r) {
-            chosen_index = i;
-            break;
+    const double beta = smts_beta;
+
+    // Child values, turned into the softmax CDF in place once the children
+    // are searched, and child i's line in row i; a child's line is at most
+    // depth - 1 moves long. A staged node does not know its move count
+    // up front and takes room for the most there can be.
+    const ScratchArena::Mark mark = ctx.scratch.mark();
+    const size_t width = staged ? MoveList::Capacity : moves.size();
+    double *child_vals = ctx.scratch.alloc<double>(width);
+    const int stride = depth - 1;
+    Move *rows = ctx.scratch.alloc<Move>(width * stride);
+    uint8_t child_len[MoveList::Capacity];
+    int count = 0;
+
+    // Running log-sum-exp of the children so far, as max + log(sum). The
+    // sum is only kept when pruning; the max always is.
+    double run_max = -std::numeric_limits<double>::infinity();
+    double run_sum = 0.0;
+    bool cut = false;
+
+    // Fold val into the running bound; true once it reaches bound.
+    auto reaches_bound = [&](double val) {
+        if (val > run_max) {
+            run_sum = run_sum * fast_exp(beta * (run_max - val)) + 1.0;
+            run_max = val;
+        } else {
+            run_sum += fast_exp(beta * (val - run_max));
+        }
+        return run_max + std::log(run_sum) / beta >= bound;
+    };
+
+    StateInfo &st = ctx.states[ply];
+
+    // Frontier: every child is a leaf, so they are made, scored in one
+    // batch and fed to the softmax directly. With NNUE each child's
+    // accumulator is updated from this node's, and the output layer runs
+    // over all of them at once. The root keeps the per-child path for its
+    // root-move bookkeeping, and pruning usually stops after a few children.
+    if (depth == 1 && ply > 0 && !prune) {
+        const int n = moves.size();
+        Position *frontier = ctx.scratch.alloc<Position>(n);
+        const bool nnue = NNUE.loaded();
+        const Accumulator *parentAcc = nnue ? &accumulator(pos, ctx, ply) : nullptr;
+        Accumulator *childAcc = ctx.scratch.alloc<Accumulator>(nnue ? n : 0);
+        for (int i = 0; i < n; i++) {
+            ctx.countNode(ply + 1);
+            if (ctx.pollTime) time_man.update(ctx);
+            StateInfo childState;
+            new (&frontier[i]) Position(*pos);
+            frontier[i].doMove(moves[i], childState);
+            if (nnue) {
+                NNUE.update(*parentAcc, childAcc[i], childState);
+                childAcc[i].key = frontier[i].hash;
+            }
+        }
+        int scores[MoveList::Capacity];
+        if (nnue) {
+            NNUE.evaluate(childAcc, n, pos->side ^ 1, scores);
+        } else {
+            evaluateBatch(frontier, n, scores);
+        }
+        ctx.stats.add(SearchStats::Evals, n);
+
+        const double inf = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < n; i++) {
+            child_len[i] = 0;
+            // qsearch below the child picks its accumulator up from acc[ply + 1].
+            if (nnue) ctx.acc[ply + 1] = childAcc[i];
+            child_vals[i] = ctx.isDraw(frontier[i], ply + 1)
+                ? 0.0 : -qsearch(&frontier[i], ply + 1, ctx, -inf, inf, scores[i]);
+            run_max = std::max(run_max, child_vals[i]);
+        }
+        count = n;
+    } else {
+        MovePicker picker = staged ? MovePicker(pos, tt_move(pos, ctx), ctx.stats) : MovePicker(moves);
+        if (staged) moves.clear();
+        Move move;
+        while (!(move = picker.next()).isNone()) {
+            if (staged) moves.push(move);
+
+            // A child worth less than run_max + log(tolerance) carries weight
+            // below tolerance relative to the best sibling; it may stop as soon
+            // as it proves that.
+            const double childBound = (prune && count > 0)
+                ? -(run_max + logTolerance / beta) : std::numeric_limits<double>::infinity();
+
+            if (ply == 0) report_currmove(ctx, depth, move, count + 1);
+            const uint64_t before = ctx.nodes.load(std::memory_order_relaxed);
+            pos->doMove(move, st);
+            double val = -SMTS(pos, depth - 1, ply + 1, ctx, childBound);
+            pos->undoMove(move, st);
+
+            // A root child cut short by stop is dropped, so a partial iteration
+            // still returns a result over the children it finished.
+            if (ply == 0 && stop_search.load(std::memory_order_relaxed)) break;
+
+            const int len = ctx.pvLength[ply + 1];
+            std::copy(ctx.pv[ply + 1], ctx.pv[ply + 1] + len, rows + count * stride);
+            child_len[count] = static_cast<uint8_t>(len);
+            child_vals[count++] = val;
+            if (ply == 0) {
+                ctx.updateRootMove(move, val, ctx.nodes.load(std::memory_order_relaxed) - before);
+            }
+
+            if (!prune) {
+                run_max = std::max(run_max, val);
+            } else if (reaches_bound(val)) {
+                cut = true;
+                break;
+            }
+
+            if (stop_search.load(std::memory_order_relaxed)) break;
         }
     }
 
-    pv.clear();
-    pv.push_back(moves[chosen_index]);
-    for (const auto &m : child_pvs[chosen_index]) {
-        pv.push_back(m);
+    // No legal moves, or interrupted before the first child finished.
+    if (count == 0) {
+        ctx.scratch.rewind(mark);
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
     }
 
-    double softmax_eval = (1.0 / beta) * std::log(total_weight) + max_val;
+    const double softmax_eval = softmax_cdf(child_vals, count, beta, run_max);
+    const int chosen_index = sample_cdf(child_vals, count, std::uniform_real_distribution<double>(0.0, 1.0)(ctx.rng));
+
+    ctx.setLine(ply, moves[chosen_index], rows + chosen_index * stride, child_len[chosen_index]);
+    ctx.scratch.rewind(mark);
+
+    if (!cut && !stop_search.load(std::memory_order_relaxed)) {
+        ctx.tt->store(pos->hash, depth, softmax_eval, moves[chosen_index]);
+    }
     return softmax_eval;
 }
 
-static double MABS(const Position* pos, int depth, std::vector<Move>& pv, std::mt19937 &rng) {
+static double MABS(Position* pos, int depth, int ply, SearchContext &ctx) {
+    ctx.countNode(ply);
+    if (ctx.pollTime) time_man.update(ctx);
     if (stop_search.load(std::memory_order_relaxed)) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
     }
 
-    if (depth == 0) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+    // The last ply of the stacks is a leaf, so no child indexes past them.
+    if (ply >= MAX_PLY - 1) {
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
     }
 
-    std::vector<Move> moves = getMoves(pos);
+    if (ply > 0 && ctx.isDraw(*pos, ply)) {
+        ctx.pvLength[ply] = 0;
+        return 0.0;
+    }
+    if (depth == 0) return quiesce(pos, ply, ctx);
+
+    double ttValue;
+    if (probeTT(pos, depth, ply, ctx, ttValue)) {
+        return ttValue;
+    }
+
+    MoveList moves = gen_search_moves(pos, ply, ctx);
     if (moves.empty()) {
-        pv.clear();
-        return static_cast<double>(evaluate(pos));
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
+    }
+    if (ctx.helper) {
+        std::shuffle(moves.begin(), moves.end(), ctx.rng);
     }
 
     const int n = static_cast<int>(moves.size());
     const int iterations = 100;
 
-    std::vector<int> plays(n, 0);
-    std::vector<double> totalReward(n, 0.0);
-    std::vector<double> bestReward(n, -std::numeric_limits<double>::infinity());
-    std::vector<std::vector<Move>> bestPV(n);
+    const ScratchArena::Mark mark = ctx.scratch.mark();
+    int *plays = ctx.scratch.alloc<int>(n);
+    double *totalReward = ctx.scratch.alloc<double>(n);
+    double *bestReward = ctx.scratch.alloc<double>(n);
+    std::fill_n(plays, n, 0);
+    std::fill_n(totalReward, n, 0.0);
+    std::fill_n(bestReward, n, -std::numeric_limits<double>::infinity());
+    // Arm i's best line is kept in row i, at most depth - 1 moves long.
+    const int stride = depth - 1;
+    Move *rows = ctx.scratch.alloc<Move>(static_cast<size_t>(n) * stride);
+    uint8_t bestLen[MoveList::Capacity] = {};
+    // Only filled at the root, for the root move list.
+    uint64_t *armNodes = ctx.scratch.alloc<uint64_t>(ply == 0 ? n : 0);
+    std::fill_n(armNodes, ply == 0 ? n : 0, 0);
+    int played = 0;
+    StateInfo &st = ctx.states[ply];
 
     for (int iter = 1; iter <= iterations; iter++) {
         if (stop_search.load(std::memory_order_relaxed)) break;
@@ -154,7 +1071,7 @@ static double MABS(const Position* pos, int depth, std::vector<Move>& pv, std::m
                 ucb = std::numeric_limits<double>::infinity();
             } else {
                 double avg = totalReward[i] / plays[i];
-                ucb = avg + std::sqrt(2.0 * std::log(static_cast<double>(iter)) / plays[i]);
+                ucb = avg + std::sqrt(ctx.explore * std::log(static_cast<double>(iter)) / plays[i]);
             }
 
             if (ucb > bestUcb) {
@@ -165,19 +1082,38 @@ static double MABS(const Position* pos, int depth, std::vector<Move>& pv, std::m
 
         if (selected < 0) break;
 
-        Position child = pos->makeMove(moves[selected]);
-        std::vector<Move> localPV;
-        double reward = -MABS(&child, depth - 1, localPV, rng);
+        ctx.stats.add(SearchStats::BanditPlayouts);
+        if (ply == 0) report_currmove(ctx, depth, moves[selected], selected + 1);
+        const uint64_t before = ctx.nodes.load(std::memory_order_relaxed);
+        pos->doMove(moves[selected], st);
+        double reward = -MABS(pos, depth - 1, ply + 1, ctx);
+        pos->undoMove(moves[selected], st);
+
+        // As in SMTS, a root playout cut short by stop is not counted.
+        if (ply == 0 && stop_search.load(std::memory_order_relaxed)) break;
+        if (ply == 0) {
+            armNodes[selected] += ctx.nodes.load(std::memory_order_relaxed) - before;
+        }
 
         plays[selected]++;
+        played++;
         totalReward[selected] += reward;
 
         if (plays[selected] == 1 || reward > bestReward[selected]) {
             bestReward[selected] = reward;
-            bestPV[selected] = std::move(localPV);
+            const int len = ctx.pvLength[ply + 1];
+            std::copy(ctx.pv[ply + 1], ctx.pv[ply + 1] + len, rows + selected * stride);
+            bestLen[selected] = static_cast<uint8_t>(len);
         }
     }
 
+    // Stopped before the first playout finished.
+    if (played == 0) {
+        ctx.scratch.rewind(mark);
+        ctx.pvLength[ply] = 0;
+        return static_cast<double>(evaluate(pos, ctx, ply));
+    }
+
     // Choose arm by highest average reward (fallback to bestReward if unplayed).
     int bestArm = 0;
     double bestAvg = -std::numeric_limits<double>::infinity();
@@ -193,24 +1129,34 @@ static double MABS(const Position* pos, int depth, std::vector<Move>& pv, std::m
             bestAvg = avg;
             bestArm = i;
         }
+        if (ply == 0 && plays[i] > 0) {
+            ctx.updateRootMove(moves[i], avg, armNodes[i]);
+        }
     }
 
-    pv.clear();
-    pv.push_back(moves[bestArm]);
-    for (const auto &m : bestPV[bestArm]) {
-        pv.push_back(m);
-    }
+    ctx.setLine(ply, moves[bestArm], rows + bestArm * stride, bestLen[bestArm]);
+    ctx.scratch.rewind(mark);
 
+    if (!stop_search.load(std::memory_order_relaxed)) {
+        ctx.tt->store(pos->hash, depth, bestAvg, moves[bestArm]);
+    }
     return bestAvg;
 }
 
-static Move uci_to_move(const std::string &moveStr) {
-    if (moveStr.size() < 4) return Move(-1, -1);
+// Parse a UCI move string and resolve it against the legal moves of pos, so
+// the result carries the same flag bits as a generated move. Strings that do
+// not name a legal move are still returned as a plain from/to move.
+static Move uci_to_move(const Position &pos, const std::string &moveStr) {
+    if (moveStr.size() < 4) return Move();
 
     int fromFile = moveStr[0] - 'a';
     int fromRank = moveStr[1] - '1';
     int toFile   = moveStr[2] - 'a';
     int toRank   = moveStr[3] - '1';
+    if (fromFile < 0 || fromFile >= 8 || fromRank < 0 || fromRank >= 8 ||
+        toFile < 0 || toFile >= 8 || toRank < 0 || toRank >= 8) {
+        return Move();
+    }
 
     int from = fromRank * 8 + fromFile;
     int to   = toRank * 8 + toFile;
@@ -227,45 +1173,970 @@ static Move uci_to_move(const std::string &moveStr) {
         }
     }
 
+    for (const Move &m : pos.genMoves()) {
+        if (m.from() == from && m.to() == to && m.promotion() == promotion) return m;
+    }
     return Move(from, to, promotion);
 }
 
-static uint64_t get_time_ms() {
-    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::steady_clock::now().time_since_epoch()).count());
+// -----------------------------------------------------------------------------
+// Search thread: one persistent worker, reused for every `go`
+// -----------------------------------------------------------------------------
+
+// Serialises output from the search thread and the UCI loop.
+static std::mutex io_mutex;
+
+static void sync_print(const std::string &text) {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    std::cout << text << std::flush;
+}
+
+// The UCI loop hands each search to this thread and keeps reading commands,
+// so stop, isready and quit are handled while the search runs.
+class SearchThread {
+public:
+    SearchThread() : worker([this] { idleLoop(); }) {}
+
+    ~SearchThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            exiting = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    // Queue a job and return immediately. The previous job must be finished.
+    void start(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = std::move(fn);
+            searching = true;
+        }
+        cv.notify_all();
+    }
+
+    // Block until the current job, if any, has finished.
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !searching; });
+    }
+
+private:
+    void idleLoop() {
+        while (true) {
+            std::function<void()> fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return searching || exiting; });
+                if (!searching) return;
+                fn = std::move(job);
+            }
+
+            fn();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                searching = false;
+            }
+            cv.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::function<void()> job;
+    bool searching = false;
+    bool exiting = false;
+    std::thread worker; // last, so it starts after the members above exist
+};
+
+// Lazy SMP: Threads - 1 helpers search the same root as the main search
+// thread, sharing the TT and the stop flag. Each keeps its own Position copy,
+// ply stack and RNG stream.
+struct HelperThread {
+    SearchThread thread;
+    SearchContext ctx;
+    Position pos;
+    SearchResult result;
+};
+
+static std::vector<std::unique_ptr<HelperThread>> helpers;
+static constexpr int MaxThreads = 1024;
+
+static void set_threads(int threads) {
+    helpers.clear();
+    for (int i = 1; i < threads; i++) {
+        auto h = std::make_unique<HelperThread>();
+        std::seed_seq seq{0x66757A7Au, static_cast<uint32_t>(i)};
+        h->ctx.rng.seed(seq);
+        h->ctx.helper = true;
+        h->ctx.pollTime = false;
+        h->ctx.explore = std::uniform_real_distribution<double>(1.0, 3.0)(h->ctx.rng);
+        helpers.push_back(std::move(h));
+    }
+}
+
+static uint64_t total_nodes(const SearchContext &ctx) {
+    uint64_t nodes = ctx.nodes.load(std::memory_order_relaxed);
+    for (const auto &h : helpers) {
+        nodes += h->ctx.nodes.load(std::memory_order_relaxed);
+    }
+    return nodes;
+}
+
+// Deepest ply any thread has reached.
+static int total_seldepth(const SearchContext &ctx) {
+    int depth = ctx.seldepth.load(std::memory_order_relaxed);
+    for (const auto &h : helpers) {
+        depth = std::max(depth, h->ctx.seldepth.load(std::memory_order_relaxed));
+    }
+    return depth;
+}
+
+static uint64_t total_stat(const SearchContext &ctx, SearchStats::Counter c) {
+    uint64_t n = ctx.stats.get(c);
+    for (const auto &h : helpers) {
+        n += h->ctx.stats.get(c);
+    }
+    return n;
+}
+
+// The counters of all threads as one info string, for `debug on`.
+static void report_stats(const SearchContext &ctx) {
+    if (!CollectStats) {
+        sync_print("info string search counters not compiled in\n");
+        return;
+    }
+    const uint64_t probes = total_stat(ctx, SearchStats::TTProbes);
+    const uint64_t hits = total_stat(ctx, SearchStats::TTHits);
+    std::ostringstream info;
+    info << "info string evals " << total_stat(ctx, SearchStats::Evals)
+         << " movegens " << total_stat(ctx, SearchStats::MoveGens)
+         << " ttprobes " << probes
+         << " tthits " << hits
+         << " (" << (probes ? hits * 100 / probes : 0) << "%)"
+         << " illegalttmoves " << total_stat(ctx, SearchStats::IllegalTTMoves)
+         << " banditplayouts " << total_stat(ctx, SearchStats::BanditPlayouts)
+         << '\n';
+    sync_print(info.str());
+}
+
+// Scratch arena peak of the last search, summed over all threads.
+static size_t scratch_peak(const SearchContext &ctx) {
+    size_t bytes = ctx.scratch.peakBytes();
+    for (const auto &h : helpers) {
+        bytes += h->ctx.scratch.peakBytes();
+    }
+    return bytes;
+}
+
+// Fresh root move list for a new search, TT move first.
+static void init_root_moves(SearchContext &ctx, Position &pos) {
+    MoveList moves = pos.genMoves();
+    ctx.stats.add(SearchStats::MoveGens);
+    tt_move_first(&pos, ctx, moves);
+    ctx.rootMoves.clear();
+    for (Move m : moves) {
+        ctx.rootMoves.push_back(RootMove{m});
+    }
+}
+
+// Helper loop: iterative deepening until stopped, keeping only completed
+// iterations. Odd helpers start one ply deeper so threads are spread across
+// depths rather than all working on the same iteration.
+static void helper_search(HelperThread &h, int index, int target_depth, bool bandit) {
+    for (int depth = 1 + (index % 2); depth <= target_depth; depth++) {
+        h.ctx.sortRootMoves();
+        double eval = bandit ? MABS(&h.pos, depth, 0, h.ctx)
+                             : SMTS(&h.pos, depth, 0, h.ctx);
+        if (stop_search.load(std::memory_order_relaxed)) break;
+        if (h.ctx.pvLength[0] > 0) {
+            h.result.depth = depth;
+            h.result.eval = eval;
+            h.result.pv = h.ctx.line(0);
+        }
+    }
+}
+
+// Run the main iterative-deepening loop on pos, with the helpers searching
+// alongside, and return the best result: deepest completed iteration first,
+// then highest score. With report, an info line is printed per iteration.
+static SearchResult run_search(Position &pos, SearchContext &ctx, int target_depth,
+                               bool bandit, bool report, uint64_t start_time) {
+    using namespace std;
+
+    ctx.resetCounters();
+    ctx.scratch.reset();
+    ctx.report = report;
+    init_root_moves(ctx, pos);
+    const int helperLimit = target_depth;
+    for (size_t i = 0; i < helpers.size(); i++) {
+        HelperThread &h = *helpers[i];
+        h.pos = pos;
+        h.ctx.copyGame(ctx);
+        h.result = SearchResult();
+        h.ctx.resetCounters();
+        h.ctx.scratch.reset();
+        init_root_moves(h.ctx, h.pos);
+        const int index = static_cast<int>(i) + 1;
+        h.thread.start([&h, index, helperLimit, bandit]() { helper_search(h, index, helperLimit, bandit); });
+    }
+
+    // best is the last completed iteration; last may be one cut short by
+    // stop, and is what the main thread plays unless a helper got further.
+    int current_depth = 0;
+    SearchResult best;
+    SearchResult last;
+
+    while (true) {
+        current_depth++;
+        if (stop_search.load(std::memory_order_relaxed)) break;
+        if (current_depth >= MAX_PLY) break;
+        ctx.sortRootMoves();
+
+        double eval;
+
+        if (bandit) {
+            eval = MABS(&pos, current_depth, 0, ctx);
+        } else {
+            eval = SMTS(&pos, current_depth, 0, ctx);
+        }
+        const std::vector<Move> pv = ctx.line(0);
+
+        // An iteration stopped before its first root move finished has
+        // nothing to report or keep.
+        if (report && !pv.empty()) {
+            const uint64_t nodes = total_nodes(ctx);
+            const uint64_t elapsed = get_time_ms() - start_time;
+            ostringstream info;
+            info << "info depth " << current_depth
+                 << " seldepth " << total_seldepth(ctx)
+                 << " score cp " << static_cast<int>(std::lround(eval))
+                 << " nodes " << nodes
+                 << " nps " << nodes * 1000 / std::max<uint64_t>(elapsed, 1)
+                 << " time " << elapsed
+                 << " hashfull " << TT.hashfull()
+                 << " pv ";
+
+            for (const auto &m : pv) {
+                info << move_to_uci(m) << ' ';
+            }
+            info << '\n';
+            sync_print(info.str());
+            if (debug_mode) report_stats(ctx);
+        }
+
+        if (!pv.empty()) {
+            last.depth = current_depth;
+            last.eval = eval;
+            last.pv = pv;
+            if (!stop_search.load(std::memory_order_relaxed)) best = last;
+        }
+
+        if (current_depth >= target_depth || time_man.softExpired()) {
+            break;
+        }
+    }
+
+    // The main thread decides when the search ends; helpers stop with it.
+    stop_search.store(true, std::memory_order_relaxed);
+    const SearchResult *chosen = &best;
+    for (const auto &h : helpers) {
+        h->thread.wait();
+        const SearchResult &r = h->result;
+        if (!r.pv.empty() && (r.depth > chosen->depth || (r.depth == chosen->depth && r.eval > chosen->eval))) {
+            chosen = &r;
+        }
+    }
+    if (chosen == &best) {
+        return last;
+    }
+
+    if (report) {
+        const uint64_t nodes = total_nodes(ctx);
+        ostringstream info;
+        info << "info depth " << chosen->depth
+             << " score cp " << static_cast<int>(std::lround(chosen->eval))
+             << " nodes " << nodes
+             << " nps " << nodes * 1000 / std::max<uint64_t>(get_time_ms() - start_time, 1)
+             << " hashfull " << TT.hashfull()
+             << " pv ";
+        for (const auto &m : chosen->pv) {
+            info << move_to_uci(m) << ' ';
+        }
+        info << '\n';
+        sync_print(info.str());
+    }
+    return *chosen;
+}
+
+// -----------------------------------------------------------------------------
+// MCTS: one persistent UCT tree grown by select/expand/evaluate/backprop
+// -----------------------------------------------------------------------------
+
+// Rewards live in [0, 1]; centipawn evaluations are squashed with a logistic
+// curve so the UCB1 exploration term is on the same scale as the values.
+static double cp_to_reward(double cp) {
+    return 1.0 / (1.0 + std::exp(-cp / 400.0));
+}
+
+static double reward_to_cp(double reward) {
+    reward = std::clamp(reward, 1e-6, 1.0 - 1e-6);
+    return 400.0 * std::log(reward / (1.0 - reward));
+}
+
+struct MCTSNode {
+    Move move;               // move from the parent
+    uint16_t numChildren = 0;
+    int32_t firstChild = -1; // children are contiguous; -1 until expanded
+    uint32_t visits = 0;
+    double reward = 0.0;     // summed for the side that played move
+};
+
+class MCTSTree {
+public:
+    // Pool capacity in nodes (about 24 MB). The tree outlives a search, so
+    // it keeps its own two pools rather than using the scratch arena. Each
+    // is reserved at full size once and compaction swaps them.
+    static constexpr size_t Capacity = 1 << 20;
+
+    void clear() {
+        nodes.clear();
+        hasRoot = false;
+    }
+
+    // Make pos the root. If pos is the current root, one of its children or
+    // one of its grandchildren (our move, then the opponent's reply), that
+    // subtree is kept and compacted to the front of the pool.
+    void setRoot(const Position &pos);
+
+    // Run playouts until stopped (by `stop` or the time manager) and return
+    // the most-visited line. Once the pool is full, leaves are evaluated
+    // without being expanded, so the search uses all of its budget; with
+    // untilFull (no clock or node limit) it ends there instead.
+    SearchResult search(SearchContext &ctx, bool report, uint64_t start_time, bool untilFull);
+
+private:
+    bool playout(SearchContext &ctx);
+    int select(int parent, double explore) const;
+    SearchResult principalVariation() const;
+    void compact(int newRoot);
+
+    Position rootPos;
+    bool hasRoot = false;
+    std::vector<MCTSNode> nodes; // nodes[0] is the root
+    std::vector<MCTSNode> spare; // compaction target, swapped with nodes
+    std::vector<std::pair<int, int>> queue; // compaction work list, (old index, new index)
+};
+
+static MCTSTree mcts_tree;
+
+void MCTSTree::setRoot(const Position &pos) {
+    int newRoot = -1;
+    if (hasRoot && !nodes.empty()) {
+        if (rootPos.hash == pos.hash) {
+            newRoot = 0;
+        } else if (nodes[0].firstChild >= 0) {
+            Position p = rootPos;
+            StateInfo st1, st2;
+            const MCTSNode &root = nodes[0];
+            for (int c = root.firstChild; c < root.firstChild + root.numChildren && newRoot < 0; c++) {
+                p.doMove(nodes[c].move, st1);
+                if (p.hash == pos.hash) {
+                    newRoot = c;
+                } else if (nodes[c].firstChild >= 0) {
+                    const MCTSNode &child = nodes[c];
+                    for (int g = child.firstChild; g < child.firstChild + child.numChildren; g++) {
+                        p.doMove(nodes[g].move, st2);
+                        const bool match = (p.hash == pos.hash);
+                        p.undoMove(nodes[g].move, st2);
+                        if (match) {
+                            newRoot = g;
+                            break;
+                        }
+                    }
+                }
+                p.undoMove(nodes[c].move, st1);
+            }
+        }
+    }
+
+    if (newRoot > 0) {
+        compact(newRoot);
+    } else if (newRoot < 0) {
+        nodes.clear();
+    }
+    if (nodes.empty()) {
+        nodes.reserve(Capacity);
+        nodes.emplace_back();
+    }
+    rootPos = pos;
+    hasRoot = true;
+}
+
+// Copy the subtree under newRoot breadth-first into the spare pool, keeping
+// each family of children contiguous, then swap pools.
+void MCTSTree::compact(int newRoot) {
+    spare.clear();
+    spare.reserve(Capacity);
+    spare.push_back(nodes[newRoot]);
+    spare[0].move = Move();
+
+    queue.clear();
+    queue.emplace_back(newRoot, 0);
+    for (size_t head = 0; head < queue.size(); head++) {
+        const int oldIndex = queue[head].first;
+        const int newIndex = queue[head].second;
+        const MCTSNode &old = nodes[oldIndex];
+        if (old.firstChild < 0) continue;
+
+        spare[newIndex].firstChild = static_cast<int32_t>(spare.size());
+        for (int i = 0; i < old.numChildren; i++) {
+            spare.push_back(nodes[old.firstChild + i]);
+            queue.emplace_back(old.firstChild + i, static_cast<int>(spare.size()) - 1);
+        }
+    }
+    nodes.swap(spare);
+    spare.clear();
+}
+
+int MCTSTree::select(int parent, double explore) const {
+    const MCTSNode &p = nodes[parent];
+    const double logN = std::log(static_cast<double>(std::max<uint32_t>(p.visits, 1)));
+
+    int best = p.firstChild;
+    double bestUcb = -std::numeric_limits<double>::infinity();
+    for (int c = p.firstChild; c < p.firstChild + p.numChildren; c++) {
+        const MCTSNode &child = nodes[c];
+        if (child.visits == 0) return c;
+        const double ucb = child.reward / child.visits + std::sqrt(explore * logN / child.visits);
+        if (ucb > bestUcb) {
+            bestUcb = ucb;
+            best = c;
+        }
+    }
+    return best;
+}
+
+// One iteration. Returns false when the pool could not hold the expansion;
+// the leaf is still evaluated and backed up.
+bool MCTSTree::playout(SearchContext &ctx) {
+    ctx.countNode(0);
+    if (ctx.pollTime) time_man.update(ctx);
+
+    int path[MAX_PLY];
+    int len = 0;
+    int cur = 0;
+    path[len++] = cur;
+
+    // Select: descend through expanded nodes by UCB1.
+    while (nodes[cur].firstChild >= 0 && nodes[cur].numChildren > 0 && len < MAX_PLY) {
+        cur = select(cur, ctx.explore);
+        rootPos.doMove(nodes[cur].move, ctx.states[len - 1]);
+        path[len++] = cur;
+    }
+    ctx.reachPly(len - 1);
+
+    // Expand: add every legal move as an unvisited child.
+    bool full = false;
+    if (nodes[cur].firstChild < 0 && len < MAX_PLY) {
+        const MoveList moves = rootPos.genMoves();
+        ctx.stats.add(SearchStats::MoveGens);
+        if (nodes.size() + moves.size() > nodes.capacity()) {
+            full = true;
+        } else {
+            const int first = static_cast<int>(nodes.size());
+            for (Move m : moves) {
+                nodes.emplace_back();
+                nodes.back().move = m;
+            }
+            nodes[cur].firstChild = first;
+            nodes[cur].numChildren = static_cast<uint16_t>(moves.size());
+        }
+    }
+
+    // Evaluate the leaf for its side to move, then back the reward up,
+    // flipping perspective at every ply.
+    double reward;
+    if (nodes[cur].firstChild >= 0 && nodes[cur].numChildren == 0) {
+        // Terminal: mated (a win for whoever moved into it) or stalemate.
+        reward = rootPos.checkInfo().checkers ? 1.0 : 0.5;
+    } else {
+        reward = 1.0 - cp_to_reward(static_cast<double>(evaluate(&rootPos, ctx, len - 1)));
+    }
+    for (int i = len - 1; i >= 0; i--) {
+        MCTSNode &n = nodes[path[i]];
+        n.visits++;
+        n.reward += reward;
+        reward = 1.0 - reward;
+        if (i > 0) {
+            rootPos.undoMove(n.move, ctx.states[i - 1]);
+        }
+    }
+    return !full;
+}
+
+SearchResult MCTSTree::principalVariation() const {
+    SearchResult result;
+    int cur = 0;
+    while (nodes[cur].firstChild >= 0 && nodes[cur].numChildren > 0) {
+        const MCTSNode &p = nodes[cur];
+        int best = -1;
+        for (int c = p.firstChild; c < p.firstChild + p.numChildren; c++) {
+            if (nodes[c].visits > 0 && (best < 0 || nodes[c].visits > nodes[best].visits)) best = c;
+        }
+        if (best < 0) break;
+        if (cur == 0) {
+            result.eval = reward_to_cp(nodes[best].reward / nodes[best].visits);
+        }
+        result.pv.push_back(nodes[best].move);
+        cur = best;
+    }
+    result.depth = static_cast<int>(result.pv.size());
+    return result;
+}
+
+SearchResult MCTSTree::search(SearchContext &ctx, bool report, uint64_t start_time, bool untilFull) {
+    ctx.resetCounters();
+    // Helpers sit this search out; what they counted in the last one must
+    // not count against a node limit.
+    for (auto &h : helpers) h->ctx.resetCounters();
+    uint64_t nextReport = start_time + 1000;
+
+    for (uint64_t n = 1; !stop_search.load(std::memory_order_relaxed); n++) {
+        if (!playout(ctx) && untilFull) break;
+
+        if (report && (n & 1023) == 0 && get_time_ms() >= nextReport) {
+            nextReport += 1000;
+            const SearchResult r = principalVariation();
+            const uint64_t elapsed = get_time_ms() - start_time;
+            std::ostringstream info;
+            info << "info depth " << r.depth
+                 << " seldepth " << ctx.seldepth.load(std::memory_order_relaxed)
+                 << " score cp " << static_cast<int>(std::lround(r.eval))
+                 << " nodes " << n
+                 << " nps " << n * 1000 / std::max<uint64_t>(elapsed, 1)
+                 << " time " << elapsed
+                 << " pv ";
+            for (const auto &m : r.pv) {
+                info << move_to_uci(m) << ' ';
+            }
+            info << '\n';
+            sync_print(info.str());
+        }
+    }
+
+    const SearchResult result = principalVariation();
+    if (report) {
+        const uint64_t n = ctx.nodes.load(std::memory_order_relaxed);
+        const uint64_t elapsed = get_time_ms() - start_time;
+        std::ostringstream info;
+        info << "info depth " << result.depth
+             << " seldepth " << ctx.seldepth.load(std::memory_order_relaxed)
+             << " score cp " << static_cast<int>(std::lround(result.eval))
+             << " nodes " << n
+             << " nps " << n * 1000 / std::max<uint64_t>(elapsed, 1)
+             << " time " << elapsed
+             << " pv ";
+        for (const auto &m : result.pv) {
+            info << move_to_uci(m) << ' ';
+        }
+        info << '\n';
+        sync_print(info.str());
+    }
+    return result;
+}
+
+// The game as the UCI loop knows it: what the last `position` command
+// started from ("startpos" or a FEN), the moves played since (sent by the
+// GUI or played by the engine), and the hash of every position along the
+// way, oldest first, for repetition detection.
+struct GameRecord {
+    std::string base;
+    std::vector<std::string> moves;
+    std::vector<uint64_t> hashes;
+
+    void reset(const std::string &from, const Position &pos) {
+        base = from;
+        moves.clear();
+        hashes.assign(1, pos.getZobristHash());
+    }
+
+    void play(Position &pos, Move m, const std::string &uci) {
+        pos = pos.makeMove(m);
+        moves.push_back(uci);
+        hashes.push_back(pos.getZobristHash());
+    }
+};
+
+// Search for one `go`, run on the search thread. Prints the info lines and
+// bestmove, then plays the move on pos and records it in game.
+static void think(Position &pos, GameRecord &game, SearchContext &ctx, const SearchLimits &limits,
+                  int target_depth, bool bandit, bool mcts) {
+    const uint64_t start_time = get_time_ms();
+    ctx.setGame(game.hashes);
+
+    // An infinite search waits for stop and a ponder search for ponderhit,
+    // so neither is answered from the book.
+    if (own_book && !limits.infinite && !limits.ponder && BOOK.loaded()) {
+        const Move m = BOOK.probe(pos, ctx.rng);
+        if (!m.isNone()) {
+            sync_print("info string book move " + move_to_uci(m) + "\n");
+            sync_print("bestmove " + move_to_uci(m) + "\n");
+            game.play(pos, m, move_to_uci(m));
+            return;
+        }
+    }
+
+    time_man.init(limits, pos.side, start_time);
+
+    SearchResult result;
+    if (mcts) {
+        // The tree is single-threaded; helpers stay idle in this mode.
+        mcts_tree.setRoot(pos);
+        result = mcts_tree.search(ctx, true, start_time, !limits.limited());
+        stop_search.store(true, std::memory_order_relaxed);
+    } else {
+        result = run_search(pos, ctx, target_depth, bandit, true, start_time);
+        if (debug_mode) sync_print("info string scratch peak " + std::to_string(scratch_peak(ctx)) + " bytes\n");
+    }
+
+    while (time_man.holdAnswer()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (!result.pv.empty()) {
+        std::string answer = "bestmove " + move_to_uci(result.pv[0]);
+        if (result.pv.size() > 1) answer += " ponder " + move_to_uci(result.pv[1]);
+        sync_print(answer + "\n");
+        game.play(pos, result.pv[0], move_to_uci(result.pv[0]));
+    } else {
+        sync_print("bestmove 0000\n");
+    }
 }
 
-extern "C" int cpp_main(int /*argc*/, char ** /*argv*/) {
+// -----------------------------------------------------------------------------
+// Bench: fixed-depth search over a built-in suite, reproducible run to run
+// -----------------------------------------------------------------------------
+
+static const char *const BenchFens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "2r3k1/pppR1pp1/4p3/4P1P1/5P2/1P4K1/P1P5/8 w - - 0 1",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 80",
+};
+
+static constexpr uint32_t BenchSeed = 0x66757A7A; // any fixed value will do
+
+// Run iterative deepening to depth on every bench position with SMTS, then
+// with MABS. The total node count per engine is a signature of the search:
+// it only changes when search behaviour does.
+struct BenchRun {
+    uint64_t nodes = 0;
+    uint64_t elapsed = 0;
+    size_t scratchPeak = 0; // largest over the positions
+    std::vector<SearchResult> results;
+};
+
+static BenchRun bench_suite(int depth, size_t hashMB, bool bandit, bool print) {
+    using namespace std;
+
+    TT.resize(hashMB);
+    SearchContext ctx;
+    ctx.rng.seed(BenchSeed);
+
+    BenchRun run;
+    const uint64_t start = get_time_ms();
+    const int count = static_cast<int>(sizeof(BenchFens) / sizeof(BenchFens[0]));
+    for (int i = 0; i < count; i++) {
+        Position pos = Position::fromFEN(BenchFens[i]);
+        stop_search.store(false, std::memory_order_relaxed);
+        TT.newSearch();
+        ctx.setGame({pos.hash});
+
+        time_man.init(SearchLimits(), pos.side, start);
+        run.results.push_back(run_search(pos, ctx, depth, bandit, false, start));
+        const uint64_t nodes = total_nodes(ctx);
+        run.nodes += nodes;
+        run.scratchPeak = std::max(run.scratchPeak, scratch_peak(ctx));
+        if (print) {
+            cout << (bandit ? "MABS" : "SMTS") << " position " << (i + 1) << '/' << count
+                 << ": " << nodes << " nodes" << '\n';
+        }
+    }
+    run.elapsed = std::max<uint64_t>(get_time_ms() - start, 1);
+    return run;
+}
+
+// With a pruning tolerance, SMTS is also run unpruned so the cost of the
+// tolerance shows up as root value error and best-move agreement.
+static void bench(int depth, int threads, size_t hashMB, double tolerance) {
+    using namespace std;
+
+    depth = std::clamp(depth, 1, MAX_PLY - 1);
+    const size_t savedHelpers = helpers.size();
+    const double savedTolerance = smts_tolerance;
+    set_threads(threads);
+
+    for (int engine = 0; engine < 2; engine++) {
+        const bool bandit = (engine == 1);
+        smts_tolerance = bandit ? 0.0 : tolerance;
+        const BenchRun run = bench_suite(depth, hashMB, bandit, true);
+
+        cout << "===========================" << '\n'
+             << "Engine          : " << (bandit ? "MABS" : "SMTS") << '\n'
+             << "Depth           : " << depth << '\n'
+             << "Threads         : " << threads << '\n'
+             << "Hash (MB)       : " << hashMB << '\n';
+        if (!bandit && tolerance > 0.0) {
+            cout << "Tolerance       : " << tolerance << '\n';
+        }
+        cout << "Total time (ms) : " << run.elapsed << '\n'
+             << "Nodes searched  : " << run.nodes << '\n'
+             << "Nodes/second    : " << run.nodes * 1000 / run.elapsed << '\n'
+             << "Scratch peak (B): " << run.scratchPeak << '\n';
+
+        if (!bandit && tolerance > 0.0) {
+            smts_tolerance = 0.0;
+            const BenchRun exact = bench_suite(depth, hashMB, false, false);
+            double maxError = 0.0;
+            double sumError = 0.0;
+            int agree = 0;
+            for (size_t i = 0; i < run.results.size(); i++) {
+                const double error = std::abs(run.results[i].eval - exact.results[i].eval);
+                maxError = std::max(maxError, error);
+                sumError += error;
+                const Move a = run.results[i].pv.empty() ? Move() : run.results[i].pv[0];
+                const Move b = exact.results[i].pv.empty() ? Move() : exact.results[i].pv[0];
+                agree += (a == b);
+            }
+            cout << "Unpruned nodes  : " << exact.nodes << '\n'
+                 << "Mean value error: " << sumError / run.results.size() << '\n'
+                 << "Max value error : " << maxError << '\n'
+                 << "Best move agrees: " << agree << '/' << run.results.size() << '\n';
+        }
+        cout << '\n' << flush;
+    }
+
+    smts_tolerance = savedTolerance;
+    set_threads(static_cast<int>(savedHelpers) + 1);
+    stop_search.store(false, std::memory_order_relaxed);
+}
+
+// -----------------------------------------------------------------------------
+// Batch analysis: fixed-depth searches over an EPD or FEN file
+// -----------------------------------------------------------------------------
+
+// `analyse --epd FILE --depth N [--threads T] [--hash MB] [--mab]`
+//
+// Each worker takes the next line of the file when it is free. Memory stays
+// flat however long the file is, and a slow position holds up no one else.
+// A worker owns its search context and TT (hash MB each). Its RNG is
+// reseeded from the line number, so a position's result barely depends on
+// which worker ran it. Results come out in the order they finish, one
+// flushed line per position:
+//   <line> <fen> ; bestmove <m> ; score cp <v> ; depth <d> ; nodes <n> ; pv <moves>
+// <line> is the 1-based input line, for restoring file order. Blank lines
+// and lines starting with '#' are skipped.
+struct AnalyseOptions {
+    std::string file;
+    int depth = 8;
+    int threads = 1;
+    size_t hashMB = TranspositionTable::DefaultMB;
+    bool bandit = false;
+};
+
+// The input file, shared by the workers one line at a time.
+class LineFeed {
+public:
+    explicit LineFeed(const std::string &path) : in(path) {}
+    bool good() const { return static_cast<bool>(in); }
+
+    bool next(std::string &line, uint64_t &number) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!std::getline(in, line)) return false;
+        number = ++count;
+        return true;
+    }
+
+private:
+    std::ifstream in;
+    std::mutex mutex;
+    uint64_t count = 0;
+};
+
+// The first four FEN fields of an EPD or FEN line, plus the move counters
+// when the line has them; empty if it does not look like a position.
+static std::string epd_position(const std::string &line) {
+    std::istringstream iss(line);
+    std::string fields[6];
+    for (int i = 0; i < 4; i++) {
+        if (!(iss >> fields[i])) return std::string();
+    }
+    std::string fen = fields[0] + ' ' + fields[1] + ' ' + fields[2] + ' ' + fields[3];
+    if (iss >> fields[4] >> fields[5] && fields[4].find_first_not_of("0123456789") == std::string::npos &&
+        fields[5].find_first_not_of("0123456789") == std::string::npos) {
+        fen += ' ' + fields[4] + ' ' + fields[5];
+    }
+    return fen;
+}
+
+static void analyse_worker(LineFeed &feed, SearchContext &ctx, const AnalyseOptions &options) {
+    std::string line;
+    uint64_t number;
+    while (feed.next(line, number)) {
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        const std::string fen = epd_position(line);
+        std::ostringstream out;
+        out << number << ' ';
+        const Position pos = fen.empty() ? Position() : Position::fromFEN(fen);
+        if (fen.empty() || __builtin_popcountll(pos.pieces[Position::K]) != 1 ||
+            __builtin_popcountll(pos.pieces[Position::k]) != 1) {
+            out << "error ; not a position: " << line.substr(first) << '\n';
+            sync_print(out.str());
+            continue;
+        }
+
+        Position root = pos;
+        std::seed_seq seq{BenchSeed, static_cast<uint32_t>(number), static_cast<uint32_t>(number >> 32)};
+        ctx.rng.seed(seq);
+        ctx.setGame({root.hash});
+        ctx.resetCounters();
+        ctx.scratch.reset();
+        ctx.tt->newSearch();
+        init_root_moves(ctx, root);
+
+        SearchResult result;
+        for (int depth = 1; depth <= options.depth; depth++) {
+            ctx.sortRootMoves();
+            const double eval = options.bandit ? MABS(&root, depth, 0, ctx) : SMTS(&root, depth, 0, ctx);
+            if (ctx.pvLength[0] == 0) break; // no legal moves
+            result.depth = depth;
+            result.eval = eval;
+            result.pv = ctx.line(0);
+        }
+
+        out << fen
+            << " ; bestmove " << (result.pv.empty() ? "0000" : move_to_uci(result.pv[0]))
+            << " ; score cp " << static_cast<int>(std::lround(result.pv.empty() ? 0.0 : result.eval))
+            << " ; depth " << result.depth
+            << " ; nodes " << ctx.nodes.load(std::memory_order_relaxed)
+            << " ; pv";
+        for (Move m : result.pv) {
+            out << ' ' << move_to_uci(m);
+        }
+        out << '\n';
+        sync_print(out.str());
+    }
+}
+
+static void analyse(const AnalyseOptions &options) {
+    LineFeed feed(options.file);
+    if (!feed.good()) {
+        sync_print("error: cannot open " + options.file + "\n");
+        return;
+    }
+
+    const int count = std::clamp(options.threads, 1, MaxThreads);
+    std::vector<std::unique_ptr<SearchContext>> contexts;
+    std::vector<std::unique_ptr<TranspositionTable>> tables;
+    for (int i = 0; i < count; i++) {
+        tables.push_back(std::make_unique<TranspositionTable>());
+        tables.back()->resize(options.hashMB);
+        contexts.push_back(std::make_unique<SearchContext>());
+        contexts.back()->tt = tables.back().get();
+        contexts.back()->pollTime = false;
+    }
+
+    stop_search.store(false, std::memory_order_relaxed);
+    std::vector<std::thread> pool;
+    for (int i = 1; i < count; i++) {
+        pool.emplace_back([&feed, &options, &ctx = *contexts[i]]() { analyse_worker(feed, ctx, options); });
+    }
+    analyse_worker(feed, *contexts[0], options);
+    for (std::thread &t : pool) t.join();
+}
+
+extern "C" int cpp_main(int argc, char **argv) {
     using namespace std;
 
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
+    Position::init();
+    size_t hashMB = TranspositionTable::DefaultMB;
+    TT.resize(hashMB);
+
     string line;
     Position pos = Position::create_start_position();
 
-    gameHashes.clear();
-    gameHashes.push_back(pos.getZobristHash());
-
-    int movetime = 0;
+    GameRecord game;
+    game.reset("startpos", pos);
 
-    // RNG used by SMTS/MABS.
-    std::mt19937 rng(static_cast<uint32_t>(
+    // RNG and ply stack used by SMTS/MABS.
+    SearchContext ctx;
+    ctx.rng.seed(static_cast<uint32_t>(
         std::chrono::steady_clock::now().time_since_epoch().count()));
 
-    while (getline(cin, line)) {
+    // Command-line arguments form a single command that runs in place of the
+    // interactive loop, e.g. `fuzzymax perft 6` or `fuzzymax divide 4 threads 8`.
+    istringstream cliInput;
+    if (argc > 1) {
+        string command;
+        for (int i = 1; i < argc; i++) {
+            if (i > 1) command += ' ';
+            command += argv[i];
+        }
+        cliInput.str(command + "\n");
+    }
+    istream &input = (argc > 1) ? static_cast<istream &>(cliInput) : cin;
+
+    // Declared after pos and ctx so it is joined before they are destroyed.
+    SearchThread searchThread;
+
+    while (getline(input, line)) {
+        // Only these are handled while a search runs; everything else reads
+        // or changes state the search thread is using, so wait for it.
+        if (line.rfind("isready", 0) != 0 && line.rfind("stop", 0) != 0 &&
+            line.rfind("quit", 0) != 0 && line.rfind("ponderhit", 0) != 0) {
+            searchThread.wait();
+        }
+
         if (line == "uci") {
             cout << "id name fuzzy-Max (SMTS & MABS integrated)" << '\n';
             cout << "option name MAB type check default false" << '\n';
-            cout << "uciok" << '\n';
+            cout << "option name MCTS type check default false" << '\n';
+            cout << "option name SMTSTolerance type string default 0" << '\n';
+            cout << "option name SMTSBeta type string default 1" << '\n';
+            cout << "option name MoveOverhead type spin default 10 min 0 max 5000" << '\n';
+            cout << "option name Ponder type check default false" << '\n';
+            cout << "option name EvalFile type string default <empty>" << '\n';
+            cout << "option name OwnBook type check default false" << '\n';
+            cout << "option name BookFile type string default <empty>" << '\n';
+            cout << "option name Threads type spin default 1 min 1 max " << MaxThreads << '\n';
+            cout << "option name Hash type spin default " << TranspositionTable::DefaultMB
+                 << " min 1 max " << TranspositionTable::MaxMB << '\n';
+            cout << "uciok" << '\n' << flush;
         }
         else if (line.rfind("isready", 0) == 0) {
-            cout << "readyok" << '\n';
+            sync_print("readyok\n");
         }
         else if (line.rfind("ucinewgame", 0) == 0) {
             pos = Position::create_start_position();
-            gameHashes.clear();
-            gameHashes.push_back(pos.getZobristHash());
+            game.reset("startpos", pos);
+            TT.clear();
+            mcts_tree.clear();
             stop_search.store(false, std::memory_order_relaxed);
         }
         else if (line.rfind("position", 0) == 0) {
@@ -276,50 +2147,41 @@ extern "C" int cpp_main(int /*argc*/, char ** /*argv*/) {
             string posType;
             iss >> posType;
 
+            string base;
             if (posType == "startpos") {
-                pos = Position::create_start_position();
-                gameHashes.clear();
-                gameHashes.push_back(pos.getZobristHash());
-
-                string movesToken;
-                if (iss >> movesToken && movesToken == "moves") {
-                    while (iss >> token) {
-                        Move m = uci_to_move(token);
-                        pos = pos.makeMove(m);
-                        gameHashes.push_back(pos.getZobristHash());
-                    }
-                }
+                base = posType;
+                iss >> token; // moves
             }
             else if (posType == "fen") {
-                vector<string> fenParts;
                 while (iss >> token && token != "moves") {
-                    fenParts.push_back(token);
-                }
-
-                string fen;
-                for (size_t i = 0; i < fenParts.size(); i++) {
-                    fen += fenParts[i];
-                    if (i + 1 < fenParts.size()) fen += ' ';
+                    if (!base.empty()) base += ' ';
+                    base += token;
                 }
+            }
+            else {
+                continue;
+            }
+            vector<string> moves;
+            if (token == "moves") {
+                while (iss >> token) moves.push_back(token);
+            }
 
-                pos = Position::fromFEN(fen);
-                gameHashes.clear();
-                gameHashes.push_back(pos.getZobristHash());
-
-                if (token == "moves") {
-                    while (iss >> token) {
-                        Move m = uci_to_move(token);
-                        pos = pos.makeMove(m);
-                        gameHashes.push_back(pos.getZobristHash());
-                    }
-                }
+            // A GUI resends the whole game every move; when this one only
+            // adds moves to the game as it stands, play just those.
+            size_t known = 0;
+            if (base == game.base && moves.size() >= game.moves.size() &&
+                std::equal(game.moves.begin(), game.moves.end(), moves.begin())) {
+                known = game.moves.size();
+            } else {
+                pos = (posType == "startpos") ? Position::create_start_position() : Position::fromFEN(base);
+                game.reset(base, pos);
+            }
+            for (size_t i = known; i < moves.size(); i++) {
+                game.play(pos, uci_to_move(pos, moves[i]), moves[i]);
             }
         }
         else if (line.rfind("go", 0) == 0) {
-            movetime = 0;
-            int target_depth = MaxDepth;
-            int wtime = 0;
-            int btime = 0;
+            SearchLimits limits;
 
             istringstream go_iss(line);
             string go_token;
@@ -327,95 +2189,216 @@ extern "C" int cpp_main(int /*argc*/, char ** /*argv*/) {
 
             while (go_iss >> go_token) {
                 if (go_token == "depth") {
-                    go_iss >> target_depth;
+                    go_iss >> limits.depth;
                 } else if (go_token == "movetime") {
-                    go_iss >> movetime;
+                    go_iss >> limits.movetime;
                 } else if (go_token == "wtime") {
-                    go_iss >> wtime;
+                    go_iss >> limits.time[0];
                 } else if (go_token == "btime") {
-                    go_iss >> btime;
+                    go_iss >> limits.time[1];
+                } else if (go_token == "winc") {
+                    go_iss >> limits.inc[0];
+                } else if (go_token == "binc") {
+                    go_iss >> limits.inc[1];
+                } else if (go_token == "movestogo") {
+                    go_iss >> limits.movestogo;
+                } else if (go_token == "nodes") {
+                    go_iss >> limits.nodes;
+                } else if (go_token == "mate") {
+                    go_iss >> limits.mate;
+                } else if (go_token == "infinite") {
+                    limits.infinite = true;
+                } else if (go_token == "ponder") {
+                    limits.ponder = true;
                 }
             }
 
-            if (movetime == 0) {
-                movetime = (pos.side == 0 ? wtime : btime);
-            }
+            // A bare `go` keeps the old fixed default depth; any other limit
+            // lets the deepening loop run until that limit ends it.
+            int target_depth = limits.depth > 0 ? limits.depth : (limits.limited() ? MAX_PLY - 1 : MaxDepth);
+            // There is no mate score to stop on, so `go mate n` searches the
+            // 2n - 1 plies a mate in n needs.
+            if (limits.mate > 0) target_depth = std::min(target_depth, 2 * limits.mate - 1);
+            target_depth = std::clamp(target_depth, 1, MAX_PLY - 1);
 
-            const uint64_t start_time = get_time_ms();
             stop_search.store(false, std::memory_order_relaxed);
-
-            std::thread timer_thread;
-            if (movetime > 0) {
-                const uint64_t searchTime = static_cast<uint64_t>(movetime) / 15;
-                timer_thread = std::thread([start_time, searchTime]() {
-                    // sleep-loop to avoid burning CPU
-                    while (!stop_search.load(std::memory_order_relaxed) &&
-                           (get_time_ms() - start_time < searchTime)) {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                    }
-                    stop_search.store(true, std::memory_order_relaxed);
-                });
+            time_man.beginSearch(limits);
+            TT.newSearch();
+
+            const bool bandit = use_bandit_search;
+            const bool mcts = use_mcts;
+            searchThread.start([&pos, &game, &ctx, limits, target_depth, bandit, mcts]() {
+                think(pos, game, ctx, limits, target_depth, bandit, mcts);
+            });
+        }
+        else if (line.rfind("setoption", 0) == 0) {
+            if (line.find("name MAB") != string::npos) {
+                const bool bandit = (line.find("value true") != string::npos);
+                // SMTS and MABS store different kinds of value under the same keys.
+                if (bandit != use_bandit_search) TT.clear();
+                use_bandit_search = bandit;
             }
-
-            int current_depth = 0;
-            std::vector<Move> best_pv;
-
-            while (true) {
-                current_depth++;
-                if (stop_search.load(std::memory_order_relaxed)) break;
-
-                std::vector<Move> pv;
-                double eval;
-
-                if (use_bandit_search) {
-                    eval = MABS(&pos, current_depth, pv, rng);
+            else if (line.find("name SMTSTolerance") != string::npos) {
+                const size_t valuePos = line.find("value");
+                if (valuePos != string::npos) {
+                    smts_tolerance = std::clamp(std::atof(line.c_str() + valuePos + 5), 0.0, 1.0);
+                }
+            }
+            else if (line.find("name SMTSBeta") != string::npos) {
+                const size_t valuePos = line.find("value");
+                if (valuePos != string::npos) {
+                    const double beta = std::clamp(std::atof(line.c_str() + valuePos + 5), 0.001, 1000.0);
+                    // Stored SMTS values are log-sum-exps under the old beta.
+                    if (beta != smts_beta) TT.clear();
+                    smts_beta = beta;
+                }
+            }
+            else if (line.find("name MoveOverhead") != string::npos) {
+                const size_t valuePos = line.find("value");
+                if (valuePos != string::npos) {
+                    move_overhead = std::clamp(std::atoi(line.c_str() + valuePos + 5), 0, 5000);
+                }
+            }
+            else if (line.find("name EvalFile") != string::npos) {
+                const size_t valuePos = line.find(" value ");
+                string path = valuePos != string::npos ? line.substr(valuePos + 7) : string();
+                path.erase(path.find_last_not_of(" \t\r") + 1);
+                string error;
+                if (path.empty() || path == "<empty>") {
+                    NNUE.unload();
+                    sync_print("info string using the piece-square evaluation\n");
+                } else if (NNUE.load(path, error)) {
+                    sync_print("info string NNUE evaluation using " + path + " (" + NNUE.simd() + ")\n");
                 } else {
-                    eval = SMTS(&pos, current_depth, pv, rng);
+                    sync_print("info string " + error + "\n");
                 }
-
-                cout << "info depth " << current_depth
-                     << " score cp " << static_cast<int>(std::lround(eval))
-                     << " pv ";
-
-                for (const auto &m : pv) {
-                    cout << move_to_uci(m) << ' ';
+                // Accumulators from the previous network are meaningless now.
+                ctx.resetAccumulators();
+                for (auto &h : helpers) h->ctx.resetAccumulators();
+            }
+            else if (line.find("name OwnBook") != string::npos) {
+                own_book = (line.find("value true") != string::npos);
+            }
+            else if (line.find("name BookFile") != string::npos) {
+                const size_t valuePos = line.find(" value ");
+                string path = valuePos != string::npos ? line.substr(valuePos + 7) : string();
+                path.erase(path.find_last_not_of(" \t\r") + 1);
+                string error;
+                if (path.empty() || path == "<empty>") {
+                    BOOK.unload();
+                } else if (BOOK.load(path, error)) {
+                    sync_print("info string book " + path + " (" + to_string(BOOK.size()) + " entries)\n");
+                } else {
+                    sync_print("info string " + error + "\n");
                 }
-                cout << '\n' << std::flush;
-
-                if (!pv.empty()) {
-                    best_pv = pv;
+            }
+            else if (line.find("name MCTS") != string::npos) {
+                use_mcts = (line.find("value true") != string::npos);
+            }
+            else if (line.find("name Threads") != string::npos) {
+                const size_t valuePos = line.find("value");
+                if (valuePos != string::npos) {
+                    const int threads = std::atoi(line.c_str() + valuePos + 5);
+                    set_threads(std::clamp(threads, 1, MaxThreads));
                 }
-
-                if (movetime == 0 && current_depth >= target_depth) {
-                    break;
+            }
+            else if (line.find("name Hash") != string::npos) {
+                const size_t valuePos = line.find("value");
+                if (valuePos != string::npos) {
+                    long long mb = std::atoll(line.c_str() + valuePos + 5);
+                    mb = std::clamp<long long>(mb, 1, static_cast<long long>(TranspositionTable::MaxMB));
+                    hashMB = static_cast<size_t>(mb);
+                    TT.resize(hashMB);
                 }
             }
-
-            if (timer_thread.joinable()) {
-                timer_thread.join();
+        }
+        else if (line.rfind("analyse", 0) == 0) {
+            istringstream iss(line);
+            string token;
+            AnalyseOptions options;
+            options.bandit = use_bandit_search;
+            iss >> token;
+            while (iss >> token) {
+                if (token == "--epd") iss >> options.file;
+                else if (token == "--depth") iss >> options.depth;
+                else if (token == "--threads") iss >> options.threads;
+                else if (token == "--hash") iss >> options.hashMB;
+                else if (token == "--mab") options.bandit = true;
             }
-
-            if (!best_pv.empty()) {
-                cout << "bestmove " << move_to_uci(best_pv[0]) << '\n';
-                pos = pos.makeMove(best_pv[0]);
-                gameHashes.push_back(pos.getZobristHash());
+            options.depth = std::clamp(options.depth, 1, MAX_PLY - 1);
+            options.hashMB = std::clamp<size_t>(options.hashMB, 1, TranspositionTable::MaxMB);
+            if (options.file.empty()) {
+                sync_print("usage: analyse --epd FILE --depth N [--threads T] [--hash MB] [--mab]\n");
             } else {
-                cout << "bestmove 0000" << '\n';
+                analyse(options);
             }
         }
-        else if (line.rfind("setoption", 0) == 0) {
-            if (line.find("name MAB") != string::npos) {
-                use_bandit_search = (line.find("value true") != string::npos);
+        else if (line.rfind("bench", 0) == 0) {
+            // bench [depth] [threads] [hash] [tolerance]
+            istringstream iss(line);
+            string token;
+            int depth = 3;
+            int threads = 1;
+            size_t benchHash = TranspositionTable::DefaultMB;
+            double tolerance = 0.0;
+            iss >> token >> depth >> threads >> benchHash >> tolerance;
+            bench(depth, std::clamp(threads, 1, MaxThreads), std::max<size_t>(benchHash, 1),
+                  std::clamp(tolerance, 0.0, 1.0));
+            TT.resize(hashMB);
+        }
+        else if (line.rfind("perft", 0) == 0 || line.rfind("divide", 0) == 0) {
+            // perft|divide <depth> [threads <n>] [hash <mb>] [fen <fen>]
+            istringstream iss(line);
+            string command;
+            string token;
+            int depth = 1;
+            int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            size_t hashMB = 0;
+            Position target = pos;
+
+            iss >> command >> depth;
+            while (iss >> token) {
+                if (token == "threads") {
+                    iss >> threads;
+                } else if (token == "hash") {
+                    iss >> hashMB;
+                } else if (token == "fen") {
+                    string fen;
+                    getline(iss, fen);
+                    target = Position::fromFEN(fen);
+                }
             }
+
+            perftCommand(target, depth, command == "divide", threads, hashMB, cout);
+        }
+        else if (line.rfind("debug", 0) == 0) {
+            istringstream iss(line);
+            string token, value;
+            iss >> token >> value;
+            debug_mode = (value == "on");
+        }
+        else if (line.rfind("ponderhit", 0) == 0) {
+            time_man.ponderhit();
         }
         else if (line.rfind("stop", 0) == 0) {
+            time_man.stopRequested();
             stop_search.store(true, std::memory_order_relaxed);
         }
         else if (line.rfind("quit", 0) == 0) {
+            time_man.stopRequested();
+            stop_search.store(true, std::memory_order_relaxed);
             break;
         }
     }
 
+    // A command-line `go` runs to completion; interactive input ending
+    // without quit aborts the search like quit does.
+    if (argc == 1) {
+        stop_search.store(true, std::memory_order_relaxed);
+    }
+    time_man.stopRequested();
+    searchThread.wait();
+    helpers.clear();
     return 0;
 }
 
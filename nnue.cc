@@ -0,0 +1,323 @@
+#include "nnue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NNUE_NEON 1
+#endif
+
+Network NNUE;
+
+static constexpr int Hidden = Network::Hidden;
+
+// -----------------------------------------------------------------------------
+// Kernels
+// -----------------------------------------------------------------------------
+
+// dst = src + sum(adds) - sum(subs), one Hidden-wide int16 row each. Covers
+// both a full refresh (src = bias, one add per piece) and a move (one add,
+// one or two subs).
+using ApplyFn = void (*)(int16_t *dst, const int16_t *src, const int16_t *const *adds, int nAdd,
+                         const int16_t *const *subs, int nSub);
+// sum(clip(us) * w[0, Hidden)) + sum(clip(them) * w[Hidden, 2 * Hidden)).
+using OutputFn = int32_t (*)(const int16_t *us, const int16_t *them, const int8_t *w);
+
+struct Kernels {
+    ApplyFn apply;
+    OutputFn output;
+    const char *name;
+};
+
+static void applyScalar(int16_t *dst, const int16_t *src, const int16_t *const *adds, int nAdd,
+                        const int16_t *const *subs, int nSub) {
+    for (int i = 0; i < Hidden; i++) {
+        int16_t v = src[i];
+        for (int a = 0; a < nAdd; a++) v = static_cast<int16_t>(v + adds[a][i]);
+        for (int s = 0; s < nSub; s++) v = static_cast<int16_t>(v - subs[s][i]);
+        dst[i] = v;
+    }
+}
+
+static int32_t outputScalar(const int16_t *us, const int16_t *them, const int8_t *w) {
+    int32_t sum = 0;
+    for (int i = 0; i < Hidden; i++) {
+        sum += std::clamp<int>(us[i], 0, Network::ActivationMax) * w[i];
+        sum += std::clamp<int>(them[i], 0, Network::ActivationMax) * w[Hidden + i];
+    }
+    return sum;
+}
+
+#if defined(NNUE_X86)
+
+__attribute__((target("avx2")))
+static void applyAvx2(int16_t *dst, const int16_t *src, const int16_t *const *adds, int nAdd,
+                      const int16_t *const *subs, int nSub) {
+    for (int i = 0; i < Hidden; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        for (int a = 0; a < nAdd; a++)
+            v = _mm256_add_epi16(v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(adds[a] + i)));
+        for (int s = 0; s < nSub; s++)
+            v = _mm256_sub_epi16(v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(subs[s] + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+    }
+}
+
+// Clip 32 activations to uint8 and multiply-add them against int8 weights.
+// packus interleaves its 128-bit lanes, so the qwords are put back in order
+// before the dot product.
+__attribute__((target("avx2")))
+static int32_t outputAvx2(const int16_t *us, const int16_t *them, const int8_t *w) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i clip = _mm256_set1_epi16(Network::ActivationMax);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = zero;
+
+    const int16_t *halves[2] = {us, them};
+    for (int h = 0; h < 2; h++) {
+        const int16_t *x = halves[h];
+        const int8_t *wh = w + h * Hidden;
+        for (int i = 0; i < Hidden; i += 32) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i + 16));
+            a = _mm256_min_epi16(_mm256_max_epi16(a, zero), clip);
+            b = _mm256_min_epi16(_mm256_max_epi16(b, zero), clip);
+            const __m256i u8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+            const __m256i prod = _mm256_maddubs_epi16(u8, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(wh + i)));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(prod, ones));
+        }
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void applyAvx512(int16_t *dst, const int16_t *src, const int16_t *const *adds, int nAdd,
+                        const int16_t *const *subs, int nSub) {
+    for (int i = 0; i < Hidden; i += 32) {
+        __m512i v = _mm512_loadu_si512(src + i);
+        for (int a = 0; a < nAdd; a++) v = _mm512_add_epi16(v, _mm512_loadu_si512(adds[a] + i));
+        for (int s = 0; s < nSub; s++) v = _mm512_sub_epi16(v, _mm512_loadu_si512(subs[s] + i));
+        _mm512_storeu_si512(dst + i, v);
+    }
+}
+
+// GCC 12's AVX-512 headers seed "undefined" vectors with `__Y = __Y`, which
+// -Wuninitialized reports wherever they are inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+__attribute__((target("avx512f,avx512bw")))
+static int32_t outputAvx512(const int16_t *us, const int16_t *them, const int8_t *w) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i clip = _mm512_set1_epi16(Network::ActivationMax);
+    const __m512i ones = _mm512_set1_epi16(1);
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    __m512i sum = zero;
+
+    const int16_t *halves[2] = {us, them};
+    for (int h = 0; h < 2; h++) {
+        const int16_t *x = halves[h];
+        const int8_t *wh = w + h * Hidden;
+        for (int i = 0; i < Hidden; i += 64) {
+            __m512i a = _mm512_loadu_si512(x + i);
+            __m512i b = _mm512_loadu_si512(x + i + 32);
+            a = _mm512_min_epi16(_mm512_max_epi16(a, zero), clip);
+            b = _mm512_min_epi16(_mm512_max_epi16(b, zero), clip);
+            const __m512i u8 = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(a, b));
+            const __m512i prod = _mm512_maddubs_epi16(u8, _mm512_loadu_si512(wh + i));
+            sum = _mm512_add_epi32(sum, _mm512_madd_epi16(prod, ones));
+        }
+    }
+    return _mm512_reduce_add_epi32(sum);
+}
+#pragma GCC diagnostic pop
+
+#elif defined(NNUE_NEON)
+
+static void applyNeon(int16_t *dst, const int16_t *src, const int16_t *const *adds, int nAdd,
+                      const int16_t *const *subs, int nSub) {
+    for (int i = 0; i < Hidden; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        for (int a = 0; a < nAdd; a++) v = vaddq_s16(v, vld1q_s16(adds[a] + i));
+        for (int s = 0; s < nSub; s++) v = vsubq_s16(v, vld1q_s16(subs[s] + i));
+        vst1q_s16(dst + i, v);
+    }
+}
+
+static int32_t outputNeon(const int16_t *us, const int16_t *them, const int8_t *w) {
+    const int16x8_t zero = vdupq_n_s16(0);
+    const int16x8_t clip = vdupq_n_s16(Network::ActivationMax);
+    int32x4_t sum = vdupq_n_s32(0);
+
+    const int16_t *halves[2] = {us, them};
+    for (int h = 0; h < 2; h++) {
+        const int16_t *x = halves[h];
+        const int8_t *wh = w + h * Hidden;
+        for (int i = 0; i < Hidden; i += 8) {
+            const int16x8_t a = vminq_s16(vmaxq_s16(vld1q_s16(x + i), zero), clip);
+            const int16x8_t wv = vmovl_s8(vld1_s8(wh + i));
+            sum = vmlal_s16(sum, vget_low_s16(a), vget_low_s16(wv));
+            sum = vmlal_s16(sum, vget_high_s16(a), vget_high_s16(wv));
+        }
+    }
+    return vaddvq_s32(sum);
+}
+
+#endif
+
+static Kernels selectKernels() {
+#if defined(NNUE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) return {applyAvx512, outputAvx512, "avx512"};
+    if (__builtin_cpu_supports("avx2")) return {applyAvx2, outputAvx2, "avx2"};
+#elif defined(NNUE_NEON)
+    return {applyNeon, outputNeon, "neon"};
+#endif
+    return {applyScalar, outputScalar, "scalar"};
+}
+
+static const Kernels Kernel = selectKernels();
+
+// -----------------------------------------------------------------------------
+// Network
+// -----------------------------------------------------------------------------
+
+static constexpr size_t FileSize = sizeof(NetworkHeader)
+                                 + sizeof(int16_t) * Hidden
+                                 + sizeof(int16_t) * Network::Inputs * Hidden
+                                 + sizeof(int8_t) * 2 * Hidden;
+
+static int featureIndex(int perspective, int piece, int sq) {
+    return perspective == 0 ? piece * 64 + sq : ((piece + 6) % 12) * 64 + (sq ^ 56);
+}
+
+Network::Network() = default;
+
+Network::~Network() {
+    unload();
+}
+
+bool Network::load(const std::string &path, std::string &error) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != FileSize) {
+        ::close(fd);
+        error = path + ": expected " + std::to_string(FileSize) + " bytes";
+        return false;
+    }
+    void *mapped = ::mmap(nullptr, FileSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (mapped == MAP_FAILED) {
+        error = "cannot map " + path;
+        return false;
+    }
+
+    const auto *h = static_cast<const NetworkHeader *>(mapped);
+    if (std::memcmp(h->magic, "FZMXNNUE", 8) != 0 || h->version != Version ||
+        h->hidden != static_cast<uint32_t>(Hidden)) {
+        ::munmap(mapped, FileSize);
+        error = path + ": not a version 1, 256-wide fuzzymax network";
+        return false;
+    }
+
+    unload();
+    base = mapped;
+    size = FileSize;
+    file = path;
+    header = h;
+    const char *p = static_cast<const char *>(mapped) + sizeof(NetworkHeader);
+    ftBias = reinterpret_cast<const int16_t *>(p);
+    p += sizeof(int16_t) * Hidden;
+    ftWeights = reinterpret_cast<const int16_t *>(p);
+    p += sizeof(int16_t) * Inputs * Hidden;
+    outWeights = reinterpret_cast<const int8_t *>(p);
+    return true;
+}
+
+void Network::unload() {
+    if (base) ::munmap(base, size);
+    base = nullptr;
+    size = 0;
+    file.clear();
+    header = nullptr;
+    ftBias = ftWeights = nullptr;
+    outWeights = nullptr;
+}
+
+const char *Network::simd() const {
+    return Kernel.name;
+}
+
+void Network::refresh(Accumulator &acc, const Position &pos) const {
+    for (int perspective = 0; perspective < 2; perspective++) {
+        // Pieces are added 32 at a time; FENs are not limited to 32 pieces.
+        const int16_t *src = ftBias;
+        const int16_t *adds[32];
+        int nAdd = 0;
+        Bitboard occ = pos.allOcc;
+        while (occ) {
+            const int sq = __builtin_ctzll(occ);
+            occ &= occ - 1;
+            adds[nAdd++] = ftWeights + featureIndex(perspective, pos.board[sq], sq) * Hidden;
+            if (nAdd == 32 && occ) {
+                Kernel.apply(acc.values[perspective], src, adds, nAdd, nullptr, 0);
+                src = acc.values[perspective];
+                nAdd = 0;
+            }
+        }
+        Kernel.apply(acc.values[perspective], src, adds, nAdd, nullptr, 0);
+    }
+    acc.key = pos.hash;
+}
+
+void Network::update(const Accumulator &prev, Accumulator &next, const StateInfo &st) const {
+    if (st.moved == -1) {
+        std::memcpy(next.values, prev.values, sizeof(next.values));
+        return;
+    }
+    const int from = st.move.from();
+    const int to = st.move.to();
+    const int placed = st.move.isPromotion() ? (st.moved < 6 ? 0 : 6) + st.move.promotion() : st.moved;
+
+    for (int perspective = 0; perspective < 2; perspective++) {
+        const int16_t *add = ftWeights + featureIndex(perspective, placed, to) * Hidden;
+        const int16_t *subs[2];
+        int nSub = 0;
+        subs[nSub++] = ftWeights + featureIndex(perspective, st.moved, from) * Hidden;
+        if (st.captured != -1) {
+            subs[nSub++] = ftWeights + featureIndex(perspective, st.captured, to) * Hidden;
+        }
+        Kernel.apply(next.values[perspective], prev.values[perspective], &add, 1, subs, nSub);
+    }
+}
+
+int Network::evaluate(const Accumulator &acc, int side) const {
+    const int64_t out = static_cast<int64_t>(header->outputBias)
+                      + Kernel.output(acc.values[side], acc.values[side ^ 1], outWeights);
+    return static_cast<int>(out * header->scale / (ActivationMax * WeightScale));
+}
+
+void Network::evaluate(const Accumulator *accs, int n, int side, int *out) const {
+    const int64_t bias = header->outputBias;
+    const int64_t scale = header->scale;
+    for (int i = 0; i < n; i++) {
+        const int64_t sum = bias + Kernel.output(accs[i].values[side], accs[i].values[side ^ 1], outWeights);
+        out[i] = static_cast<int>(sum * scale / (ActivationMax * WeightScale));
+    }
+}
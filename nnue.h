@@ -0,0 +1,91 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include "engine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// -----------------------------------------------------------------------------
+// NNUE: efficiently updatable network, (768 -> 256) x 2 -> 1
+// -----------------------------------------------------------------------------
+
+// Inputs are one-hot (piece, square) features seen from each side: for the
+// white perspective feature = piece * 64 + sq, for black colours are swapped
+// and the board mirrored vertically, so "own pieces" are always 0-5. Each
+// perspective's 256-wide int16 accumulator is clipped to [0, 127] and the
+// two halves, side to move first, feed one int8 output neuron.
+//
+// File layout (little-endian), memory-mapped as is:
+//   NetworkHeader                      64 bytes
+//   int16 ftBias[Hidden]
+//   int16 ftWeights[Inputs][Hidden]    column per feature
+//   int8  outWeights[2 * Hidden]
+// The evaluation in centipawns is
+//   (outputBias + sum(clip(acc) * outWeights)) * scale / (ActivationMax * WeightScale).
+
+struct NetworkHeader {
+    char magic[8];       // "FZMXNNUE"
+    uint32_t version;    // 1
+    uint32_t hidden;     // must equal Network::Hidden
+    int32_t scale;
+    int32_t outputBias;
+    uint8_t reserved[40];
+};
+
+static_assert(sizeof(NetworkHeader) == 64, "network header must be 64 bytes");
+
+struct alignas(64) Accumulator {
+    static constexpr int Hidden = 256;
+    int16_t values[2][Hidden]; // [perspective]
+    uint64_t key = 0;          // hash of the position the values belong to, 0 if none
+};
+
+class Network {
+public:
+    static constexpr int Inputs = 768;
+    static constexpr int Hidden = Accumulator::Hidden;
+    static constexpr int ActivationMax = 127;
+    static constexpr int WeightScale = 64;
+    static constexpr uint32_t Version = 1;
+
+    Network();
+    ~Network();
+    Network(const Network &) = delete;
+    Network &operator=(const Network &) = delete;
+
+    // Map path read-only; on failure the previous network, if any, is kept
+    // and error says why.
+    bool load(const std::string &path, std::string &error);
+    void unload();
+    bool loaded() const { return base != nullptr; }
+    const std::string &path() const { return file; }
+
+    // Kernel set picked for this CPU at startup ("avx512", "avx2", "neon" or
+    // "scalar").
+    const char *simd() const;
+
+    // Accumulator for pos from scratch.
+    void refresh(Accumulator &acc, const Position &pos) const;
+    // next = prev plus the feature changes of the move recorded in st.
+    void update(const Accumulator &prev, Accumulator &next, const StateInfo &st) const;
+    // Centipawns for side to move.
+    int evaluate(const Accumulator &acc, int side) const;
+    // evaluate() for n accumulators with the same side to move, in one pass
+    // over the output layer.
+    void evaluate(const Accumulator *accs, int n, int side, int *out) const;
+
+private:
+    void *base = nullptr;
+    size_t size = 0;
+    std::string file;
+    const NetworkHeader *header = nullptr;
+    const int16_t *ftBias = nullptr;
+    const int16_t *ftWeights = nullptr;
+    const int8_t *outWeights = nullptr;
+};
+
+extern Network NNUE;
+
+#endif // NNUE_H
@@ -0,0 +1,127 @@
+#include "engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Perft hash: (position, depth) -> leaf count, shared by the root-split threads
+// -----------------------------------------------------------------------------
+
+namespace {
+
+// Same XOR-verified layout as the search TT, so concurrent writers need no lock.
+struct PerftEntry {
+    std::atomic<uint64_t> key{0};
+    std::atomic<uint64_t> count{0};
+};
+
+class PerftHash {
+public:
+    explicit PerftHash(size_t mb)
+        : size(std::max<size_t>(1, mb * 1024 * 1024 / sizeof(PerftEntry))),
+          entries(new PerftEntry[size]) {}
+
+    bool probe(uint64_t key, uint64_t &count) const {
+        const PerftEntry &e = entries[key % size];
+        const uint64_t c = e.count.load(std::memory_order_relaxed);
+        if ((e.key.load(std::memory_order_relaxed) ^ c) != key || c == 0) return false;
+        count = c;
+        return true;
+    }
+
+    void store(uint64_t key, uint64_t count) {
+        PerftEntry &e = entries[key % size];
+        e.key.store(key ^ count, std::memory_order_relaxed);
+        e.count.store(count, std::memory_order_relaxed);
+    }
+
+private:
+    size_t size;
+    std::unique_ptr<PerftEntry[]> entries;
+};
+
+// Fold the remaining depth into the key so one table serves every ply.
+uint64_t perftKey(uint64_t hash, int depth) {
+    return hash ^ (0x9E3779B97F4A7C15ULL * static_cast<uint64_t>(depth));
+}
+
+uint64_t perftRecurse(Position &pos, int depth, PerftHash *hash) {
+    MoveList moves = pos.genMoves();
+
+    // Bulk counting: the legal generator already gives the leaf count.
+    if (depth <= 1) return depth == 1 ? moves.size() : 1;
+
+    uint64_t nodes;
+    const uint64_t key = perftKey(pos.hash, depth);
+    if (hash && hash->probe(key, nodes)) return nodes;
+
+    nodes = 0;
+    StateInfo st;
+    for (Move m : moves) {
+        pos.doMove(m, st);
+        nodes += perftRecurse(pos, depth - 1, hash);
+        pos.undoMove(m, st);
+    }
+
+    if (hash) hash->store(key, nodes);
+    return nodes;
+}
+
+} // namespace
+
+uint64_t perft(Position &pos, int depth) {
+    return perftRecurse(pos, depth, nullptr);
+}
+
+void perftCommand(const Position &root, int depth, bool divide, int threads, size_t hashMB, std::ostream &out) {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+
+    depth = std::max(depth, 1);
+    threads = std::max(threads, 1);
+    std::unique_ptr<PerftHash> hash(hashMB > 0 ? new PerftHash(hashMB) : nullptr);
+
+    // Split at the root: workers pull the next unclaimed root move.
+    const MoveList moves = root.genMoves();
+    std::vector<uint64_t> counts(moves.size(), 0);
+    std::atomic<int> next{0};
+
+    auto worker = [&]() {
+        Position pos = root;
+        StateInfo st;
+        for (int i = next++; i < moves.size(); i = next++) {
+            pos.doMove(moves[i], st);
+            counts[i] = perftRecurse(pos, depth - 1, hash.get());
+            pos.undoMove(moves[i], st);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    const int helpers = std::min(threads, std::max(moves.size(), 1)) - 1;
+    for (int i = 0; i < helpers; i++) pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool) t.join();
+
+    uint64_t total = 0;
+    for (int i = 0; i < moves.size(); i++) {
+        if (divide) out << move_to_uci(moves[i]) << ": " << counts[i] << '\n';
+        total += counts[i];
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const uint64_t ms = static_cast<uint64_t>(seconds * 1000.0);
+    if (divide) out << '\n';
+    out << "Nodes searched: " << total << '\n'
+        << "Time: " << ms << " ms\n"
+        << "Mnps: " << std::fixed << std::setprecision(2)
+        << (seconds > 0.0 ? static_cast<double>(total) / seconds / 1e6 : 0.0) << '\n';
+    out.unsetf(std::ios::fixed);
+    out << std::flush;
+}
@@ -2,10 +2,9 @@
 
 #include <algorithm>
 #include <array>
+#include <cassert>
 #include <cctype>
-#include <chrono>
 #include <cstdint>
-#include <random>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -28,46 +27,433 @@ const int Position::queenDir[8][2] = {
 };
 
 // -----------------------------------------------------------------------------
-// Zobrist Hashing Setup for Threefold Repetition
+// Leaper Attack Tables
 // -----------------------------------------------------------------------------
 
-static uint64_t ZobristTable[12][64];
-static uint64_t ZobristBlack;
-static bool zobristInitialized = false;
+Bitboard KnightAttacks[64];
+Bitboard KingAttacks[64];
+Bitboard PawnAttacks[2][64];
 
-static void initZobrist() {
-    if (zobristInitialized) return;
+static Bitboard leaperAttack(const int deltas[][2], int numDeltas, int sq) {
+    Bitboard attacks = 0;
+    for (int d = 0; d < numDeltas; d++) {
+        int r = sq / 8 + deltas[d][0];
+        int f = sq % 8 + deltas[d][1];
+        if (r < 0 || r >= 8 || f < 0 || f >= 8) continue;
+        attacks |= 1ULL << (r * 8 + f);
+    }
+    return attacks;
+}
+
+static void initLeapers() {
+    static const int knightDeltas[8][2] = {
+        {2, 1}, {1, 2}, {-1, 2}, {-2, 1},
+        {-2, -1}, {-1, -2}, {1, -2}, {2, -1}
+    };
+    static const int kingDeltas[8][2] = {
+        {1,0}, {1,1}, {0,1}, {-1,1},
+        {-1,0}, {-1,-1}, {0,-1}, {1,-1}
+    };
+    static const int whitePawnDeltas[2][2] = { {1, -1}, {1, 1} };
+    static const int blackPawnDeltas[2][2] = { {-1, -1}, {-1, 1} };
+
+    for (int sq = 0; sq < 64; sq++) {
+        KnightAttacks[sq] = leaperAttack(knightDeltas, 8, sq);
+        KingAttacks[sq] = leaperAttack(kingDeltas, 8, sq);
+        PawnAttacks[0][sq] = leaperAttack(whitePawnDeltas, 2, sq);
+        PawnAttacks[1][sq] = leaperAttack(blackPawnDeltas, 2, sq);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Slider Attack Tables
+// -----------------------------------------------------------------------------
+
+Magic BishopMagics[64];
+Magic RookMagics[64];
+
+static Bitboard BishopTable[0x1480];
+static Bitboard RookTable[0x19000];
 
-    std::mt19937_64 rng(static_cast<uint64_t>(
-        std::chrono::steady_clock::now().time_since_epoch().count()));
+// Ray-walk attacks from sq, stopping at (and including) the first blocker.
+// Only used to fill the lookup tables.
+static Bitboard slidingAttack(const int dir[][2], int sq, Bitboard occ) {
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; d++) {
+        int r = sq / 8;
+        int f = sq % 8;
+        while (true) {
+            r += dir[d][0];
+            f += dir[d][1];
+            if (r < 0 || r >= 8 || f < 0 || f >= 8) break;
+
+            Bitboard mask = 1ULL << (r * 8 + f);
+            attacks |= mask;
+            if (occ & mask) break;
+        }
+    }
+    return attacks;
+}
+
+#ifndef USE_PEXT
+// xorshift64*, seeded per square so magic search is deterministic.
+static uint64_t magicRand(uint64_t &s) {
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 2685821657736338717ULL;
+}
+#endif
+
+static void initMagics(Bitboard *table, Magic magics[], const int dir[][2]) {
+    // Attack sets indexed by subset number, and the epoch at which each
+    // table slot was last written while trying the current candidate.
+    std::vector<Bitboard> occupancy(4096), reference(4096);
+    size_t size = 0;
+#ifndef USE_PEXT
+    std::vector<int> epoch(4096, 0);
+    int attempt = 0;
+    // Per-rank seeds (Stockfish's) that find every magic in a few
+    // thousand candidates, so startup stays fast.
+    static constexpr uint64_t Seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+#endif
+
+    for (int sq = 0; sq < 64; sq++) {
+        const int rank = sq / 8;
+        const int file = sq % 8;
+        const Bitboard edges = ((Rank1BB | Rank8BB) & ~(Rank1BB << (8 * rank)))
+                             | ((FileABB | FileHBB) & ~(FileABB << file));
+
+        Magic &m = magics[sq];
+        m.mask = slidingAttack(dir, sq, 0) & ~edges;
+        m.shift = 64 - __builtin_popcountll(m.mask);
+        m.attacks = (sq == 0) ? table : magics[sq - 1].attacks + size;
+
+        // Enumerate every subset of the mask (Carry-Rippler) and record the
+        // true attack set for it.
+        size = 0;
+        Bitboard b = 0;
+        do {
+            occupancy[size] = b;
+            reference[size] = slidingAttack(dir, sq, b);
+#ifdef USE_PEXT
+            m.attacks[_pext_u64(b, m.mask)] = reference[size];
+#endif
+            size++;
+            b = (b - m.mask) & m.mask;
+        } while (b);
+
+#ifndef USE_PEXT
+        uint64_t seed = Seeds[rank];
+        // Try sparse random candidates until one maps every subset to a slot
+        // that is either free or already holds the same attack set.
+        for (size_t i = 0; i < size;) {
+            m.magic = 0;
+            while (__builtin_popcountll((m.mask * m.magic) >> 56) < 6) {
+                m.magic = magicRand(seed) & magicRand(seed) & magicRand(seed);
+            }
+
+            attempt++;
+            for (i = 0; i < size; i++) {
+                unsigned idx = m.index(occupancy[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                } else if (m.attacks[idx] != reference[i]) {
+                    break;
+                }
+            }
+        }
+#endif
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Line Tables
+// -----------------------------------------------------------------------------
 
+Bitboard BetweenBB[64][64];
+Bitboard LineBB[64][64];
+
+static void initLines() {
+    for (int s1 = 0; s1 < 64; s1++) {
+        for (int s2 = 0; s2 < 64; s2++) {
+            const Bitboard b1 = 1ULL << s1;
+            const Bitboard b2 = 1ULL << s2;
+            BetweenBB[s1][s2] = 0;
+            LineBB[s1][s2] = 0;
+            if (s1 == s2) continue;
+
+            if (bishopAttacks(s1, 0) & b2) {
+                LineBB[s1][s2] = (bishopAttacks(s1, 0) & bishopAttacks(s2, 0)) | b1 | b2;
+                BetweenBB[s1][s2] = bishopAttacks(s1, b2) & bishopAttacks(s2, b1);
+            } else if (rookAttacks(s1, 0) & b2) {
+                LineBB[s1][s2] = (rookAttacks(s1, 0) & rookAttacks(s2, 0)) | b1 | b2;
+                BetweenBB[s1][s2] = rookAttacks(s1, b2) & rookAttacks(s2, b1);
+            }
+        }
+    }
+}
+
+void Position::init() {
+    initLeapers();
+    initMagics(BishopTable, BishopMagics, bishopDir);
+    initMagics(RookTable, RookMagics, rookDir);
+    initLines();
+}
+
+// -----------------------------------------------------------------------------
+// Zobrist Hashing
+// -----------------------------------------------------------------------------
+
+// Keys are generated at compile time from a fixed splitmix64 stream, so a
+// position hashes to the same value in every process and build.
+struct ZobristKeys {
+    uint64_t psq[12][64];
+    uint64_t black;
+    uint64_t castling[16];
+    uint64_t enPassant[8];
+};
+
+static constexpr uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static constexpr ZobristKeys makeZobristKeys() {
+    ZobristKeys keys{};
+    uint64_t state = 0x66757A7A796D6178ULL; // "fuzzymax"
     for (int p = 0; p < 12; p++) {
         for (int sq = 0; sq < 64; sq++) {
-            ZobristTable[p][sq] = rng();
+            keys.psq[p][sq] = splitmix64(state);
         }
     }
-    ZobristBlack = rng();
-    zobristInitialized = true;
+    keys.black = splitmix64(state);
+    keys.castling[0] = 0;
+    for (int cr = 1; cr < 16; cr++) {
+        keys.castling[cr] = splitmix64(state);
+    }
+    for (int f = 0; f < 8; f++) {
+        keys.enPassant[f] = splitmix64(state);
+    }
+    return keys;
+}
+
+static constexpr ZobristKeys Zobrist = makeZobristKeys();
+
+// Castling rights that survive a move touching each square: moving or
+// capturing on a king or rook home square clears the matching rights.
+static constexpr std::array<uint8_t, 64> makeCastlingMask() {
+    std::array<uint8_t, 64> mask{};
+    for (int sq = 0; sq < 64; sq++) mask[sq] = 15;
+    mask[4] = 15 & ~(Position::WhiteOO | Position::WhiteOOO);
+    mask[7] = 15 & ~Position::WhiteOO;
+    mask[0] = 15 & ~Position::WhiteOOO;
+    mask[60] = 15 & ~(Position::BlackOO | Position::BlackOOO);
+    mask[63] = 15 & ~Position::BlackOO;
+    mask[56] = 15 & ~Position::BlackOOO;
+    return mask;
 }
 
-uint64_t Position::getZobristHash() const {
-    initZobrist();
+static constexpr std::array<uint8_t, 64> CastlingMask = makeCastlingMask();
 
+// Full recomputation; used to seed hash and to cross-check it in debug builds.
+uint64_t Position::computeHash() const {
     uint64_t h = 0;
     for (int pieceType = 0; pieceType < 12; pieceType++) {
         Bitboard bb = pieces[pieceType];
         while (bb) {
             int sq = __builtin_ctzll(bb);
             bb &= bb - 1;
-            h ^= ZobristTable[pieceType][sq];
+            h ^= Zobrist.psq[pieceType][sq];
         }
     }
     if (side == 1) {
-        h ^= ZobristBlack;
+        h ^= Zobrist.black;
+    }
+    h ^= Zobrist.castling[castling];
+    if (epSquare >= 0) {
+        h ^= Zobrist.enPassant[epSquare % 8];
     }
     return h;
 }
 
+// -----------------------------------------------------------------------------
+// Piece-Square Evaluation
+// -----------------------------------------------------------------------------
+
+// PeSTO material and piece-square values (Ronald Friederich), as published on
+// the Chess Programming Wiki. Tables are written rank 8 first from white's
+// point of view; sq ^ 56 maps a white piece onto them.
+static constexpr int MgValue[6] = {82, 337, 365, 477, 1025, 0};
+static constexpr int EgValue[6] = {94, 281, 297, 512, 936, 0};
+static constexpr int PhaseInc[6] = {0, 1, 1, 2, 4, 0};
+
+static constexpr int MgTable[6][64] = {
+    { // pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+         98, 134,  61,  95,  68, 126,  34, -11,
+         -6,   7,  26,  31,  65,  56,  25, -20,
+        -14,  13,   6,  21,  23,  12,  17, -23,
+        -27,  -2,  -5,  12,  17,   6,  10, -25,
+        -26,  -4,  -4, -10,   3,   3,  33, -12,
+        -35,  -1, -20, -23, -15,  24,  38, -22,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    },
+    { // knight
+        -167, -89, -34, -49,  61, -97, -15, -107,
+         -73, -41,  72,  36,  23,  62,   7,  -17,
+         -47,  60,  37,  65,  84, 129,  73,   44,
+          -9,  17,  19,  53,  37,  69,  18,   22,
+         -13,   4,  16,  13,  28,  19,  21,   -8,
+         -23,  -9,  12,  10,  19,  17,  25,  -16,
+         -29, -53, -12,  -3,  -1,  18, -14,  -19,
+        -105, -21, -58, -33, -17, -28, -19,  -23,
+    },
+    { // bishop
+        -29,   4, -82, -37, -25, -42,   7,  -8,
+        -26,  16, -18, -13,  30,  59,  18, -47,
+        -16,  37,  43,  40,  35,  50,  37,  -2,
+         -4,   5,  19,  50,  37,  37,   7,  -2,
+         -6,  13,  13,  26,  34,  12,  10,   4,
+          0,  15,  15,  15,  14,  27,  18,  10,
+          4,  15,  16,   0,   7,  21,  33,   1,
+        -33,  -3, -14, -21, -13, -12, -39, -21,
+    },
+    { // rook
+         32,  42,  32,  51,  63,   9,  31,  43,
+         27,  32,  58,  62,  80,  67,  26,  44,
+         -5,  19,  26,  36,  17,  45,  61,  16,
+        -24, -11,   7,  26,  24,  35,  -8, -20,
+        -36, -26, -12,  -1,   9,  -7,   6, -23,
+        -45, -25, -16, -17,   3,   0,  -5, -33,
+        -44, -16, -20,  -9,  -1,  11,  -6, -71,
+        -19, -13,   1,  17,  16,   7, -37, -26,
+    },
+    { // queen
+        -28,   0,  29,  12,  59,  44,  43,  45,
+        -24, -39,  -5,   1, -16,  57,  28,  54,
+        -13, -17,   7,   8,  29,  56,  47,  57,
+        -27, -27, -16, -16,  -1,  17,  -2,   1,
+         -9, -26,  -9, -10,  -2,  -4,   3,  -3,
+        -14,   2, -11,  -2,  -5,   2,  14,   5,
+        -35,  -8,  11,   2,   8,  15,  -3,   1,
+         -1, -18,  -9,  10, -15, -25, -31, -50,
+    },
+    { // king
+        -65,  23,  16, -15, -56, -34,   2,  13,
+         29,  -1, -20,  -7,  -8,  -4, -38, -29,
+         -9,  24,   2, -16, -20,   6,  22, -22,
+        -17, -20, -12, -27, -30, -25, -14, -36,
+        -49,  -1, -27, -39, -46, -44, -33, -51,
+        -14, -14, -22, -46, -44, -30, -15, -27,
+          1,   7,  -8, -64, -43, -16,   9,   8,
+        -15,  36,  12, -54,   8, -28,  24,  14,
+    },
+};
+
+static constexpr int EgTable[6][64] = {
+    { // pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+        178, 173, 158, 134, 147, 132, 165, 187,
+         94, 100,  85,  67,  56,  53,  82,  84,
+         32,  24,  13,   5,  -2,   4,  17,  17,
+         13,   9,  -3,  -7,  -7,  -8,   3,  -1,
+          4,   7,  -6,   1,   0,  -5,  -1,  -8,
+         13,   8,   8,  10,  13,   0,   2,  -7,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    },
+    { // knight
+        -58, -38, -13, -28, -31, -27, -63, -99,
+        -25,  -8, -25,  -2,  -9, -25, -24, -52,
+        -24, -20,  10,   9,  -1,  -9, -19, -41,
+        -17,   3,  22,  22,  22,  11,   8, -18,
+        -18,  -6,  16,  25,  16,  17,   4, -18,
+        -23,  -3,  -1,  15,  10,  -3, -20, -22,
+        -42, -20, -10,  -5,  -2, -20, -23, -44,
+        -29, -51, -23, -15, -22, -18, -50, -64,
+    },
+    { // bishop
+        -14, -21, -11,  -8,  -7,  -9, -17, -24,
+         -8,  -4,   7, -12,  -3, -13,  -4, -14,
+          2,  -8,   0,  -1,  -2,   6,   0,   4,
+         -3,   9,  12,   9,  14,  10,   3,   2,
+         -6,   3,  13,  19,   7,  10,  -3,  -9,
+        -12,  -3,   8,  10,  13,   3,  -7, -15,
+        -14, -18,  -7,  -1,   4,  -9, -15, -27,
+        -23,  -9, -23,  -5,  -9, -16,  -5, -17,
+    },
+    { // rook
+         13,  10,  18,  15,  12,  12,   8,   5,
+         11,  13,  13,  11,  -3,   3,   8,   3,
+          7,   7,   7,   5,   4,  -3,  -5,  -3,
+          4,   3,  13,   1,   2,   1,  -1,   2,
+          3,   5,   8,   4,  -5,  -6,  -8, -11,
+         -4,   0,  -5,  -1,  -7, -12,  -8, -16,
+         -6,  -6,   0,   2,  -9,  -9, -11,  -3,
+         -9,   2,   3,  -1,  -5, -13,   4, -20,
+    },
+    { // queen
+         -9,  22,  22,  27,  27,  19,  10,  20,
+        -17,  20,  32,  41,  58,  25,  30,   0,
+        -20,   6,   9,  49,  47,  35,  19,   9,
+          3,  22,  24,  45,  57,  40,  57,  36,
+        -18,  28,  19,  47,  31,  34,  39,  23,
+        -16, -27,  15,   6,   9,  17,  10,   5,
+        -22, -23, -30, -16, -16, -23, -36, -32,
+        -33, -28, -22, -43,  -5, -32, -20, -41,
+    },
+    { // king
+        -74, -35, -18, -18, -11,  15,   4, -17,
+        -12,  17,  14,  17,  17,  38,  23,  11,
+         10,  17,  23,  15,  20,  45,  44,  13,
+         -8,  22,  24,  27,  26,  33,  26,   3,
+        -18,  -4,  21,  24,  27,  23,   9, -11,
+        -19,  -3,  11,  21,  23,  16,   7,  -9,
+        -27, -11,   4,  13,  14,   4,  -5, -17,
+        -53, -34, -21, -11, -28, -14, -24, -43,
+    },
+};
+
+// Value of each piece index on each square, material included, signed
+// white minus black.
+struct PsqTables {
+    Score psq[12][64];
+    int phase[12];
+};
+
+static constexpr PsqTables makePsqTables() {
+    PsqTables t{};
+    for (int pt = 0; pt < 6; pt++) {
+        t.phase[pt] = t.phase[pt + 6] = PhaseInc[pt];
+        for (int sq = 0; sq < 64; sq++) {
+            t.psq[pt][sq] = {MgValue[pt] + MgTable[pt][sq ^ 56], EgValue[pt] + EgTable[pt][sq ^ 56]};
+            t.psq[pt + 6][sq] = {-(MgValue[pt] + MgTable[pt][sq]), -(EgValue[pt] + EgTable[pt][sq])};
+        }
+    }
+    return t;
+}
+
+static constexpr PsqTables Psq = makePsqTables();
+
+Score Position::computePsq(int &phaseOut) const {
+    Score s;
+    phaseOut = 0;
+    for (int pieceType = 0; pieceType < 12; pieceType++) {
+        Bitboard bb = pieces[pieceType];
+        while (bb) {
+            int sq = __builtin_ctzll(bb);
+            bb &= bb - 1;
+            s.mg += Psq.psq[pieceType][sq].mg;
+            s.eg += Psq.psq[pieceType][sq].eg;
+            phaseOut += Psq.phase[pieceType];
+        }
+    }
+    return s;
+}
+
 // -----------------------------------------------------------------------------
 // Implementation of Position Methods
 // -----------------------------------------------------------------------------
@@ -88,18 +474,68 @@ Position::Position() {
         0x1000000000000000ULL  // Black king
     };
 
+    side = 0;
+    castling = WhiteOO | WhiteOOO | BlackOO | BlackOOO;
+    epSquare = -1;
+    rebuildState();
+}
+
+// Recompute everything derived from pieces[]: occupancies, the mailbox, the
+// hash and the piece-square score.
+void Position::rebuildState() {
     wOcc = pieces[0] | pieces[1] | pieces[2] | pieces[3] | pieces[4] | pieces[5];
     bOcc = pieces[6] | pieces[7] | pieces[8] | pieces[9] | pieces[10] | pieces[11];
     allOcc = wOcc | bOcc;
-    side = 0;
+
+    board.fill(NO_PIECE);
+    for (int i = 0; i < 12; i++) {
+        Bitboard bb = pieces[i];
+        while (bb) {
+            board[__builtin_ctzll(bb)] = static_cast<uint8_t>(i);
+            bb &= bb - 1;
+        }
+    }
+
+    hash = computeHash();
+    psq = computePsq(phase);
+}
+
+bool Position::isConsistent() const {
+    for (int sq = 0; sq < 64; sq++) {
+        const Bitboard mask = 1ULL << sq;
+        const int pc = board[sq];
+        if (pc == NO_PIECE) {
+            if (allOcc & mask) return false;
+            continue;
+        }
+        if (pc > NO_PIECE || !(pieces[pc] & mask)) return false;
+        if (!((pc < 6 ? wOcc : bOcc) & mask)) return false;
+    }
+    if (__builtin_popcountll(allOcc) != __builtin_popcountll(wOcc) + __builtin_popcountll(bOcc)) {
+        return false;
+    }
+    int ph = 0;
+    const Score s = computePsq(ph);
+    return hash == computeHash() && s.mg == psq.mg && s.eg == psq.eg && ph == phase;
 }
 
 Position Position::create_start_position() {
     return Position();
 }
 
+// Colours swapped and the board mirrored rank for rank, side to move
+// included: evaluation and move counts must come out the same.
 Position Position::rotate() const {
-    return *this;
+    Position r;
+    for (int i = 0; i < 12; i++) {
+        r.pieces[(i + 6) % 12] = __builtin_bswap64(pieces[i]);
+    }
+    r.side = side ^ 1;
+    r.castling = ((castling & (WhiteOO | WhiteOOO)) << 2) | ((castling >> 2) & (WhiteOO | WhiteOOO));
+    r.epSquare = epSquare < 0 ? -1 : epSquare ^ 56;
+    r.rule50 = rule50;
+    r.rebuildState();
+    return r;
 }
 
 Position::Bitboard Position::flip(Bitboard bb) {
@@ -116,403 +552,606 @@ Position::Bitboard Position::flip(Bitboard bb) {
 // Check Detection (for side-to-move king)
 // -----------------------------------------------------------------------------
 
-bool Position::is_in_check() const {
-    const int kingIndex = (side == 0 ? 5 : 11);
+template <int Us>
+bool Position::isInCheck() const {
+    constexpr int kingIndex = (Us == 0 ? 5 : 11);
     if (pieces[kingIndex] == 0) return false;
 
     const int kingSquare = __builtin_ctzll(pieces[kingIndex]);
-    const int kingRank = kingSquare / 8;
-    const int kingFile = kingSquare % 8;
+    constexpr int enemyOffset = (Us == 0 ? 6 : 0);
 
-    // Pawn attacks
-    if (side == 0) {
-        // White king, attacked by black pawns (index 6) from rank+1 diagonals
-        if (kingRank + 1 < 8) {
-            if (kingFile + 1 < 8) {
-                int sq = (kingRank + 1) * 8 + (kingFile + 1);
-                if (pieces[6] & (1ULL << sq)) return true;
-            }
-            if (kingFile - 1 >= 0) {
-                int sq = (kingRank + 1) * 8 + (kingFile - 1);
-                if (pieces[6] & (1ULL << sq)) return true;
-            }
-        }
-    } else {
-        // Black king, attacked by white pawns (index 0) from rank-1 diagonals
-        if (kingRank - 1 >= 0) {
-            if (kingFile + 1 < 8) {
-                int sq = (kingRank - 1) * 8 + (kingFile + 1);
-                if (pieces[0] & (1ULL << sq)) return true;
-            }
-            if (kingFile - 1 >= 0) {
-                int sq = (kingRank - 1) * 8 + (kingFile - 1);
-                if (pieces[0] & (1ULL << sq)) return true;
-            }
-        }
-    }
+    // Leaper attacks: a pawn of our colour on the king square would attack
+    // exactly the squares enemy pawns must stand on to give check.
+    if (PawnAttacks[Us][kingSquare] & pieces[enemyOffset + 0]) return true;
+    if (KnightAttacks[kingSquare] & pieces[enemyOffset + 1]) return true;
+    if (KingAttacks[kingSquare] & pieces[enemyOffset + 5]) return true;
 
-    // Knight attacks
-    static const int knightDeltas[8][2] = {
-        {2, 1}, {1, 2}, {-1, 2}, {-2, 1},
-        {-2, -1}, {-1, -2}, {1, -2}, {2, -1}
-    };
+    // Sliding attacks: one table lookup per slider family
+    const Bitboard enemyBQ = pieces[enemyOffset + 2] | pieces[enemyOffset + 4];
+    const Bitboard enemyRQ = pieces[enemyOffset + 3] | pieces[enemyOffset + 4];
+    if (bishopAttacks(kingSquare, allOcc) & enemyBQ) return true;
+    if (rookAttacks(kingSquare, allOcc) & enemyRQ) return true;
 
-    for (const auto &d : knightDeltas) {
-        int r = kingRank + d[0];
-        int f = kingFile + d[1];
-        if (r < 0 || r >= 8 || f < 0 || f >= 8) continue;
-        int sq = r * 8 + f;
+    return false;
+}
 
-        if (side == 0) {
-            // enemy black knight
-            if (pieces[7] & (1ULL << sq)) return true;
-        } else {
-            // enemy white knight
-            if (pieces[1] & (1ULL << sq)) return true;
-        }
-    }
+bool Position::is_checkmate() const {
+    return is_in_check() && !hasAnyLegalMove();
+}
 
-    // Adjacent enemy king
-    for (int dr = -1; dr <= 1; dr++) {
-        for (int df = -1; df <= 1; df++) {
-            if (dr == 0 && df == 0) continue;
-            int r = kingRank + dr;
-            int f = kingFile + df;
-            if (r < 0 || r >= 8 || f < 0 || f >= 8) continue;
-            int sq = r * 8 + f;
+bool Position::is_stalemate() const {
+    return !is_in_check() && !hasAnyLegalMove();
+}
 
-            if (side == 0) {
-                if (pieces[11] & (1ULL << sq)) return true;
-            } else {
-                if (pieces[5] & (1ULL << sq)) return true;
-            }
-        }
-    }
+// -----------------------------------------------------------------------------
+// Attack Queries
+// -----------------------------------------------------------------------------
 
-    // Sliding attacks: diagonals (bishop/queen)
-    static const int diagDirs[4][2] = { {1,1}, {1,-1}, {-1,1}, {-1,-1} };
-    for (const auto &d : diagDirs) {
-        int r = kingRank;
-        int f = kingFile;
-        while (true) {
-            r += d[0];
-            f += d[1];
-            if (r < 0 || r >= 8 || f < 0 || f >= 8) break;
-            int sq = r * 8 + f;
-            Bitboard mask = 1ULL << sq;
+// All pieces of either colour attacking sq, given occupancy occ.
+Position::Bitboard Position::attackersTo(int sq, Bitboard occ) const {
+    return (PawnAttacks[1][sq] & pieces[0])
+         | (PawnAttacks[0][sq] & pieces[6])
+         | (KnightAttacks[sq] & (pieces[1] | pieces[7]))
+         | (KingAttacks[sq] & (pieces[5] | pieces[11]))
+         | (bishopAttacks(sq, occ) & (pieces[2] | pieces[4] | pieces[8] | pieces[10]))
+         | (rookAttacks(sq, occ) & (pieces[3] | pieces[4] | pieces[9] | pieces[10]));
+}
 
-            if (side == 0) {
-                if ((pieces[8] | pieces[10]) & mask) return true;
-            } else {
-                if ((pieces[2] | pieces[4]) & mask) return true;
-            }
+// Static exchange evaluation: the material m wins, in centipawns, once both
+// sides have recaptured on its target square with their least valuable
+// attacker for as long as that pays. Pins are ignored; x-rays are found by
+// recomputing attackers as pieces leave the board.
+int Position::see(Move m) const {
+    static constexpr int Value[6] = {100, 300, 300, 500, 900, 20000};
+    const int to = m.to();
+    int gain[32];
+    int d = 0;
+    gain[0] = m.isCapture() ? Value[board[to] % 6] : 0;
+    int onSquare = board[m.from()] % 6;
+    if (m.isPromotion()) {
+        gain[0] += Value[m.promotion()] - Value[0];
+        onSquare = m.promotion();
+    }
 
-            if (allOcc & mask) break;
+    Bitboard occ = allOcc ^ (1ULL << m.from());
+    int stm = side ^ 1;
+    while (d < 31) {
+        const Bitboard mine = attackersTo(to, occ) & occ & (stm == 0 ? wOcc : bOcc);
+        if (!mine) break;
+        int pt = 0;
+        Bitboard from = 0;
+        for (; pt < 6; pt++) {
+            from = mine & pieces[stm * 6 + pt];
+            if (from) break;
         }
+        d++;
+        gain[d] = Value[onSquare] - gain[d - 1];
+        onSquare = pt;
+        occ ^= from & (0 - from);
+        stm ^= 1;
+    }
+    while (d > 0) {
+        gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+        d--;
     }
+    return gain[0];
+}
 
-    // Sliding attacks: straights (rook/queen)
-    static const int straightDirs[4][2] = { {1,0}, {-1,0}, {0,1}, {0,-1} };
-    for (const auto &d : straightDirs) {
-        int r = kingRank;
-        int f = kingFile;
-        while (true) {
-            r += d[0];
-            f += d[1];
-            if (r < 0 || r >= 8 || f < 0 || f >= 8) break;
-            int sq = r * 8 + f;
-            Bitboard mask = 1ULL << sq;
+// Every square attacked by Color, given occupancy occ.
+template <int Color>
+Position::Bitboard Position::attackedBy(Bitboard occ) const {
+    constexpr int offset = (Color == 0 ? 0 : 6);
+    const Bitboard pawns = pieces[offset + 0];
 
-            if (side == 0) {
-                if ((pieces[9] | pieces[10]) & mask) return true;
-            } else {
-                if ((pieces[3] | pieces[4]) & mask) return true;
-            }
+    Bitboard attacks = (Color == 0)
+        ? ((pawns & ~FileABB) << 7) | ((pawns & ~FileHBB) << 9)
+        : ((pawns & ~FileABB) >> 9) | ((pawns & ~FileHBB) >> 7);
 
-            if (allOcc & mask) break;
-        }
+    Bitboard bb = pieces[offset + 1];
+    while (bb) {
+        attacks |= KnightAttacks[__builtin_ctzll(bb)];
+        bb &= bb - 1;
     }
 
-    return false;
-}
+    bb = pieces[offset + 2] | pieces[offset + 4];
+    while (bb) {
+        attacks |= bishopAttacks(__builtin_ctzll(bb), occ);
+        bb &= bb - 1;
+    }
 
-bool Position::is_checkmate() const {
-    return is_in_check() && genMoves().empty();
+    bb = pieces[offset + 3] | pieces[offset + 4];
+    while (bb) {
+        attacks |= rookAttacks(__builtin_ctzll(bb), occ);
+        bb &= bb - 1;
+    }
+
+    if (pieces[offset + 5]) {
+        attacks |= KingAttacks[__builtin_ctzll(pieces[offset + 5])];
+    }
+    return attacks;
 }
 
-bool Position::is_stalemate() const {
-    return !is_in_check() && genMoves().empty();
+template <int Us>
+CheckInfo Position::checkInfo() const {
+    CheckInfo ci;
+    constexpr int offset = (Us == 0 ? 0 : 6);
+    constexpr int enemyOffset = (Us == 0 ? 6 : 0);
+    const Bitboard king = pieces[offset + 5];
+    if (!king) return ci;
+
+    const Bitboard friendly = (Us == 0 ? wOcc : bOcc);
+    const Bitboard enemy = (Us == 0 ? bOcc : wOcc);
+    const int ks = __builtin_ctzll(king);
+    ci.kingSquare = ks;
+    ci.checkers = attackersTo(ks, allOcc) & enemy;
+
+    // Enemy sliders on an open line to our king with exactly one of our
+    // pieces in between pin that piece.
+    const Bitboard enemyBQ = pieces[enemyOffset + 2] | pieces[enemyOffset + 4];
+    const Bitboard enemyRQ = pieces[enemyOffset + 3] | pieces[enemyOffset + 4];
+    Bitboard snipers = (bishopAttacks(ks, 0) & enemyBQ) | (rookAttacks(ks, 0) & enemyRQ);
+    while (snipers) {
+        const int sq = __builtin_ctzll(snipers);
+        snipers &= snipers - 1;
+        const Bitboard between = BetweenBB[ks][sq] & allOcc;
+        if (between && !(between & (between - 1)) && (between & friendly)) {
+            ci.pinned |= between;
+        }
+    }
+
+    // The king itself must not block slider rays when it steps away.
+    ci.kingDanger = attackedBy<1 - Us>(allOcc ^ king);
+
+    if (ci.checkers) {
+        if (ci.checkers & (ci.checkers - 1)) {
+            ci.evasions = 0; // double check: only the king may move
+        } else {
+            ci.evasions = ci.checkers | BetweenBB[ks][__builtin_ctzll(ci.checkers)];
+        }
+    }
+    return ci;
 }
 
 // -----------------------------------------------------------------------------
-// Legal Move Generation: generate pseudo-legal, then filter leaving king in check
+// Legal Move Generation: checkers, pins and king danger computed once per node
 // -----------------------------------------------------------------------------
 
-std::vector<Move> Position::genMoves() const {
-    std::vector<Move> pseudo;
-    generateSlidingMoves(pseudo, 2, bishopDir, 4);
-    generateSlidingMoves(pseudo, 3, rookDir, 4);
-    generateSlidingMoves(pseudo, 4, queenDir, 8);
-    generateKnightMoves(pseudo);
-    generateKingMoves(pseudo);
-    generatePawnMoves(pseudo);
-
-    std::vector<Move> legal;
-    legal.reserve(pseudo.size());
-    for (const Move &m : pseudo) {
-        Position next = makeMove(m);
-        if (!next.is_in_check()) {
-            legal.push_back(m);
-        }
+// Squares a piece of Us may move to for generation type Type, before
+// evasion and pin masks.
+template <int Us, Position::GenType Type>
+Position::Bitboard Position::genTargets() const {
+    if constexpr (Type == GenCaptures) return Us == 0 ? bOcc : wOcc;
+    if constexpr (Type == GenQuiets) return ~allOcc;
+    return ~(Us == 0 ? wOcc : bOcc);
+}
+
+template <int Us, Position::GenType Type>
+MoveList Position::genMoves() const {
+    const CheckInfo ci = checkInfo<Us>();
+
+    MoveList moves;
+    generateKingMoves<Us, Type>(moves, ci);
+    if (ci.evasions) {
+        generateSlidingMoves<Us, Type>(moves, 2, ci);
+        generateSlidingMoves<Us, Type>(moves, 3, ci);
+        generateSlidingMoves<Us, Type>(moves, 4, ci);
+        generateKnightMoves<Us, Type>(moves, ci);
+        generatePawnMoves<Us, Type>(moves, ci);
     }
-    return legal;
+    return moves;
 }
 
-void Position::generateSlidingMoves(std::vector<Move>& moves, int pieceType, const int dir[][2], int numDirections) const {
-    const int offset = (side == 0 ? 0 : 6);
+template <int Us, Position::GenType Type>
+void Position::generateSlidingMoves(MoveList& moves, int pieceType, const CheckInfo& ci) const {
+    constexpr int offset = (Us == 0 ? 0 : 6);
     Bitboard bb = pieces[offset + pieceType];
-    const Bitboard friendly = (side == 0 ? wOcc : bOcc);
-    const Bitboard enemy = (side == 0 ? bOcc : wOcc);
 
     while (bb) {
         int from = __builtin_ctzll(bb);
         bb &= bb - 1;
 
-        int fr = from / 8;
-        int ff = from % 8;
-
-        for (int d = 0; d < numDirections; d++) {
-            int r = fr;
-            int f = ff;
-            const int dr = dir[d][0];
-            const int df = dir[d][1];
-
-            while (true) {
-                r += dr;
-                f += df;
-                if (r < 0 || r >= 8 || f < 0 || f >= 8) break;
-
-                int to = r * 8 + f;
-                Bitboard mask = 1ULL << to;
-
-                if (friendly & mask) break;
-
-                moves.emplace_back(from, to);
+        Bitboard targets;
+        switch (pieceType) {
+            case 2: targets = bishopAttacks(from, allOcc); break;
+            case 3: targets = rookAttacks(from, allOcc); break;
+            default: targets = queenAttacks(from, allOcc); break;
+        }
+        targets &= genTargets<Us, Type>() & ci.evasions;
+        if (ci.pinned & (1ULL << from)) {
+            targets &= LineBB[ci.kingSquare][from];
+        }
 
-                if (enemy & mask) break;
-            }
+        while (targets) {
+            int to = __builtin_ctzll(targets);
+            targets &= targets - 1;
+            moves.push(Move(from, to, -1, (allOcc >> to) & 1));
         }
     }
 }
 
-void Position::generateKnightMoves(std::vector<Move>& moves) const {
-    const int offset = (side == 0 ? 0 : 6);
-    Bitboard knights = pieces[offset + 1];
-    const Bitboard friendly = (side == 0 ? wOcc : bOcc);
-
-    static const int deltas[8][2] = {
-        {2, 1}, {1, 2}, {-1, 2}, {-2, 1},
-        {-2, -1}, {-1, -2}, {1, -2}, {2, -1}
-    };
+template <int Us, Position::GenType Type>
+void Position::generateKnightMoves(MoveList& moves, const CheckInfo& ci) const {
+    constexpr int offset = (Us == 0 ? 0 : 6);
+    // A pinned knight can never stay on the pin line.
+    Bitboard knights = pieces[offset + 1] & ~ci.pinned;
+    const Bitboard mask = genTargets<Us, Type>() & ci.evasions;
 
     while (knights) {
         int from = __builtin_ctzll(knights);
         knights &= knights - 1;
 
-        int r = from / 8;
-        int f = from % 8;
+        Bitboard targets = KnightAttacks[from] & mask;
+        while (targets) {
+            int to = __builtin_ctzll(targets);
+            targets &= targets - 1;
+            moves.push(Move(from, to, -1, (allOcc >> to) & 1));
+        }
+    }
+}
 
-        for (const auto &d : deltas) {
-            int nr = r + d[0];
-            int nf = f + d[1];
-            if (nr < 0 || nr >= 8 || nf < 0 || nf >= 8) continue;
+template <int Us, Position::GenType Type>
+void Position::generateKingMoves(MoveList& moves, const CheckInfo& ci) const {
+    if (ci.kingSquare < 0) return;
 
-            int to = nr * 8 + nf;
-            Bitboard mask = 1ULL << to;
-            if (friendly & mask) continue;
+    const int from = ci.kingSquare;
+    Bitboard targets = KingAttacks[from] & genTargets<Us, Type>() & ~ci.kingDanger;
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        targets &= targets - 1;
+        moves.push(Move(from, to, -1, (allOcc >> to) & 1));
+    }
+}
 
-            moves.emplace_back(from, to);
+// Shift the whole pawn set at once: forward one, then the two capture
+// diagonals, masking off pawns that would wrap around the board edge.
+template <int Us>
+static void pawnTargets(Bitboard pawns, Bitboard empty, Bitboard enemy,
+                        Bitboard &pushes, Bitboard &capWest, Bitboard &capEast) {
+    if constexpr (Us == 0) {
+        pushes = (pawns << 8) & empty;
+        capWest = ((pawns & ~FileABB) << 7) & enemy;
+        capEast = ((pawns & ~FileHBB) << 9) & enemy;
+    } else {
+        pushes = (pawns >> 8) & empty;
+        capWest = ((pawns & ~FileABB) >> 9) & enemy;
+        capEast = ((pawns & ~FileHBB) >> 7) & enemy;
+    }
+}
+
+// Emit one move per set bit of targets, each coming from to - delta.
+static void addPawnMoves(MoveList& moves, Bitboard targets, int delta, bool promotion, bool capture) {
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        targets &= targets - 1;
+        int from = to - delta;
+        if (promotion) {
+            moves.push(Move(from, to, 1, capture));
+            moves.push(Move(from, to, 2, capture));
+            moves.push(Move(from, to, 3, capture));
+            moves.push(Move(from, to, 4, capture));
+        } else {
+            moves.push(Move(from, to, -1, capture));
         }
     }
 }
 
-void Position::generateKingMoves(std::vector<Move>& moves) const {
-    const int offset = (side == 0 ? 0 : 6);
-    Bitboard king = pieces[offset + 5];
-    const Bitboard friendly = (side == 0 ? wOcc : bOcc);
+// Captures and promotions belong to GenCaptures, the other pushes to
+// GenQuiets.
+template <int Us, Position::GenType Type>
+static void addPawnSetMoves(MoveList& moves, Bitboard pawns, Bitboard empty,
+                            Bitboard enemy, Bitboard targetMask) {
+    constexpr Bitboard promoRank = (Us == 0 ? Rank8BB : Rank1BB);
+    constexpr int up = (Us == 0 ? 8 : -8);
+    constexpr int upWest = (Us == 0 ? 7 : -9);
+    constexpr int upEast = (Us == 0 ? 9 : -7);
+
+    Bitboard pushes, capWest, capEast;
+    pawnTargets<Us>(pawns, empty, enemy, pushes, capWest, capEast);
+    pushes &= targetMask;
+    capWest &= targetMask;
+    capEast &= targetMask;
+
+    if constexpr (Type != Position::GenCaptures) {
+        addPawnMoves(moves, pushes & ~promoRank, up, false, false);
+    }
+    if constexpr (Type != Position::GenQuiets) {
+        addPawnMoves(moves, capWest & ~promoRank, upWest, false, true);
+        addPawnMoves(moves, capEast & ~promoRank, upEast, false, true);
+        addPawnMoves(moves, pushes & promoRank, up, true, false);
+        addPawnMoves(moves, capWest & promoRank, upWest, true, true);
+        addPawnMoves(moves, capEast & promoRank, upEast, true, true);
+    }
+}
 
-    if (!king) return;
+template <int Us, Position::GenType Type>
+void Position::generatePawnMoves(MoveList& moves, const CheckInfo& ci) const {
+    constexpr int offset = (Us == 0 ? 0 : 6);
+    const Bitboard pawns = pieces[offset + 0];
+    const Bitboard enemy = (Us == 0 ? bOcc : wOcc);
+
+    // Unpinned pawns go through the set-wise shifts; the few pinned ones are
+    // shifted individually so their targets can be clipped to the pin line.
+    addPawnSetMoves<Us, Type>(moves, pawns & ~ci.pinned, ~allOcc, enemy, ci.evasions);
+
+    Bitboard pinnedPawns = pawns & ci.pinned;
+    while (pinnedPawns) {
+        const int from = __builtin_ctzll(pinnedPawns);
+        pinnedPawns &= pinnedPawns - 1;
+        addPawnSetMoves<Us, Type>(moves, 1ULL << from, ~allOcc, enemy,
+                                  ci.evasions & LineBB[ci.kingSquare][from]);
+    }
+}
 
-    int from = __builtin_ctzll(king);
-    int r = from / 8;
-    int f = from % 8;
+template <int Us>
+bool Position::hasAnyLegalMove() const {
+    const CheckInfo ci = checkInfo<Us>();
+    constexpr int offset = (Us == 0 ? 0 : 6);
+    const Bitboard friendly = (Us == 0 ? wOcc : bOcc);
+    const Bitboard enemy = (Us == 0 ? bOcc : wOcc);
 
-    static const int deltas[8][2] = {
-        {1,0}, {1,1}, {0,1}, {-1,1},
-        {-1,0}, {-1,-1}, {0,-1}, {1,-1}
-    };
+    if (ci.kingSquare >= 0 && (KingAttacks[ci.kingSquare] & ~friendly & ~ci.kingDanger)) {
+        return true;
+    }
+    if (!ci.evasions) return false;
 
-    for (const auto &d : deltas) {
-        int nr = r + d[0];
-        int nf = f + d[1];
-        if (nr < 0 || nr >= 8 || nf < 0 || nf >= 8) continue;
+    const Bitboard targetMask = ~friendly & ci.evasions;
 
-        int to = nr * 8 + nf;
-        Bitboard mask = 1ULL << to;
-        if (friendly & mask) continue;
+    Bitboard bb = pieces[offset + 1] & ~ci.pinned;
+    while (bb) {
+        if (KnightAttacks[__builtin_ctzll(bb)] & targetMask) return true;
+        bb &= bb - 1;
+    }
 
-        moves.emplace_back(from, to);
+    bb = pieces[offset + 2] | pieces[offset + 3] | pieces[offset + 4];
+    while (bb) {
+        const int from = __builtin_ctzll(bb);
+        bb &= bb - 1;
+        const Bitboard fromMask = 1ULL << from;
+
+        Bitboard targets = 0;
+        if (fromMask & (pieces[offset + 2] | pieces[offset + 4])) targets |= bishopAttacks(from, allOcc);
+        if (fromMask & (pieces[offset + 3] | pieces[offset + 4])) targets |= rookAttacks(from, allOcc);
+        targets &= targetMask;
+        if (ci.pinned & fromMask) targets &= LineBB[ci.kingSquare][from];
+        if (targets) return true;
     }
+
+    const Bitboard pawns = pieces[offset + 0];
+    Bitboard pushes, capWest, capEast;
+    pawnTargets<Us>(pawns & ~ci.pinned, ~allOcc, enemy, pushes, capWest, capEast);
+    if ((pushes | capWest | capEast) & ci.evasions) return true;
+
+    bb = pawns & ci.pinned;
+    while (bb) {
+        const int from = __builtin_ctzll(bb);
+        bb &= bb - 1;
+        pawnTargets<Us>(1ULL << from, ~allOcc, enemy, pushes, capWest, capEast);
+        if ((pushes | capWest | capEast) & ci.evasions & LineBB[ci.kingSquare][from]) return true;
+    }
+    return false;
 }
 
-void Position::generatePawnMoves(std::vector<Move>& moves) const {
-    const int offset = (side == 0 ? 0 : 6);
-    Bitboard pawns = pieces[offset + 0];
-    const Bitboard enemy = (side == 0 ? bOcc : wOcc);
+template <int Us>
+bool Position::isLegal(Move m) const {
+    constexpr int offset = (Us == 0 ? 0 : 6);
+    const Bitboard friendly = (Us == 0 ? wOcc : bOcc);
+    const Bitboard enemy = (Us == 0 ? bOcc : wOcc);
+    const Bitboard fromMask = 1ULL << m.from();
+    const Bitboard toMask = 1ULL << m.to();
+    if (!(friendly & fromMask) || (friendly & toMask)) return false;
+    if (m.isCapture() != ((enemy & toMask) != 0)) return false;
+
+    const int pieceType = board[m.from()] - offset;
+
+    // Pseudo-legality: the piece must be able to reach the target.
+    Bitboard reach = 0;
+    switch (pieceType) {
+        case 0: {
+            constexpr Bitboard promoRank = (Us == 0 ? Rank8BB : Rank1BB);
+            if (m.isPromotion() != ((toMask & promoRank) != 0)) return false;
+            Bitboard pushes, capWest, capEast;
+            pawnTargets<Us>(fromMask, ~allOcc, enemy, pushes, capWest, capEast);
+            reach = pushes | capWest | capEast;
+            break;
+        }
+        case 1: reach = KnightAttacks[m.from()]; break;
+        case 2: reach = bishopAttacks(m.from(), allOcc); break;
+        case 3: reach = rookAttacks(m.from(), allOcc); break;
+        case 4: reach = queenAttacks(m.from(), allOcc); break;
+        default: reach = KingAttacks[m.from()]; break;
+    }
+    if (pieceType != 0 && m.isPromotion()) return false;
+    if (!(reach & toMask)) return false;
 
-    while (pawns) {
-        int from = __builtin_ctzll(pawns);
-        pawns &= pawns - 1;
+    const Bitboard king = pieces[offset + 5];
+    if (!king) return true;
+    const int ks = __builtin_ctzll(king);
 
-        int r = from / 8;
-        int f = from % 8;
-        int nr = (side == 0 ? r + 1 : r - 1);
-        if (nr < 0 || nr >= 8) continue;
+    if (pieceType == 5) {
+        return !(attackersTo(m.to(), allOcc ^ king) & enemy & ~toMask);
+    }
 
-        bool isPromotion = (side == 0 && nr == 7) || (side == 1 && nr == 0);
+    // Non-king moves: must resolve any check and stay on a pin line. Both
+    // reduce to "is our king attacked once the piece has moved".
+    const Bitboard occ = (allOcc ^ fromMask) | toMask;
+    return !(attackersTo(ks, occ) & enemy & ~toMask);
+}
 
-        // forward one
-        int to = nr * 8 + f;
-        Bitboard toMask = 1ULL << to;
-        if (!(allOcc & toMask)) {
-            if (isPromotion) {
-                moves.emplace_back(from, to, 1);
-                moves.emplace_back(from, to, 2);
-                moves.emplace_back(from, to, 3);
-                moves.emplace_back(from, to, 4);
-            } else {
-                moves.emplace_back(from, to);
-            }
-        }
+template <int Us>
+void Position::doMove(Move m, StateInfo &st) {
+    constexpr int offset = (Us == 0 ? 0 : 6);
+    const int from = m.from();
+    const int to = m.to();
+    const Bitboard fromBB = 1ULL << from;
+    const Bitboard toBB = 1ULL << to;
+    Bitboard &friendly = (Us == 0 ? wOcc : bOcc);
+    Bitboard &enemy = (Us == 0 ? bOcc : wOcc);
+
+    st.moved = -1;
+    st.captured = -1;
+    st.move = m;
+    st.hash = hash;
+    st.castling = castling;
+    st.epSquare = epSquare;
+    st.rule50 = rule50;
+    st.psq = psq;
+    st.phase = phase;
+
+    if (!(friendly & fromBB)) {
+        return;
+    }
+    st.moved = board[from];
 
-        // captures
-        if (f - 1 >= 0) {
-            int cap = nr * 8 + (f - 1);
-            Bitboard capMask = 1ULL << cap;
-            if (enemy & capMask) {
-                if (isPromotion) {
-                    moves.emplace_back(from, cap, 1);
-                    moves.emplace_back(from, cap, 2);
-                    moves.emplace_back(from, cap, 3);
-                    moves.emplace_back(from, cap, 4);
-                } else {
-                    moves.emplace_back(from, cap);
-                }
-            }
-        }
+    // remove captured enemy
+    if (enemy & toBB) {
+        st.captured = board[to];
+        pieces[st.captured] &= ~toBB;
+        enemy &= ~toBB;
+        hash ^= Zobrist.psq[st.captured][to];
+        psq.mg -= Psq.psq[st.captured][to].mg;
+        psq.eg -= Psq.psq[st.captured][to].eg;
+        phase -= Psq.phase[st.captured];
+    }
 
-        if (f + 1 < 8) {
-            int cap = nr * 8 + (f + 1);
-            Bitboard capMask = 1ULL << cap;
-            if (enemy & capMask) {
-                if (isPromotion) {
-                    moves.emplace_back(from, cap, 1);
-                    moves.emplace_back(from, cap, 2);
-                    moves.emplace_back(from, cap, 3);
-                    moves.emplace_back(from, cap, 4);
-                } else {
-                    moves.emplace_back(from, cap);
-                }
-            }
-        }
+    // move the piece, replacing a pawn with the promoted piece
+    const int placed = m.isPromotion() ? offset + m.promotion() : st.moved;
+    pieces[st.moved] &= ~fromBB;
+    pieces[placed] |= toBB;
+    friendly = (friendly & ~fromBB) | toBB;
+    allOcc = wOcc | bOcc;
+    board[from] = NO_PIECE;
+    board[to] = static_cast<uint8_t>(placed);
+    hash ^= Zobrist.psq[st.moved][from] ^ Zobrist.psq[placed][to];
+    psq.mg += Psq.psq[placed][to].mg - Psq.psq[st.moved][from].mg;
+    psq.eg += Psq.psq[placed][to].eg - Psq.psq[st.moved][from].eg;
+    phase += Psq.phase[placed] - Psq.phase[st.moved];
+
+    // castling rights and en-passant square
+    hash ^= Zobrist.castling[castling];
+    castling &= CastlingMask[from] & CastlingMask[to];
+    hash ^= Zobrist.castling[castling];
+
+    if (epSquare >= 0) {
+        hash ^= Zobrist.enPassant[epSquare % 8];
+        epSquare = -1;
+    }
+    if (st.moved == offset + 0 && (from ^ to) == 16) {
+        epSquare = (from + to) / 2;
+        hash ^= Zobrist.enPassant[epSquare % 8];
     }
-}
 
-Position Position::makeMove(const Move &m) const {
-    Position next = *this;
+    rule50 = (st.captured != -1 || st.moved == offset + 0) ? 0 : rule50 + 1;
 
-    const int offset = (side == 0 ? 0 : 6);
-    const int enemyOffset = (side == 0 ? 6 : 0);
+    side ^= 1;
+    hash ^= Zobrist.black;
+    assert(isConsistent());
+}
 
-    int movingPieceIndex = -1;
-    for (int i = 0; i < 6; i++) {
-        if (next.pieces[offset + i] & (1ULL << m.from)) {
-            movingPieceIndex = offset + i;
-            break;
-        }
+template <int Us>
+void Position::undoMove(Move m, const StateInfo &st) {
+    if (st.moved == -1) {
+        return;
     }
 
-    if (movingPieceIndex == -1) {
-        return next;
+    side ^= 1;
+    hash = st.hash;
+    castling = st.castling;
+    epSquare = st.epSquare;
+    rule50 = st.rule50;
+    psq = st.psq;
+    phase = st.phase;
+
+    const int from = m.from();
+    const int to = m.to();
+    const Bitboard fromBB = 1ULL << from;
+    const Bitboard toBB = 1ULL << to;
+    Bitboard &friendly = (Us == 0 ? wOcc : bOcc);
+    Bitboard &enemy = (Us == 0 ? bOcc : wOcc);
+
+    pieces[board[to]] &= ~toBB;
+    pieces[st.moved] |= fromBB;
+    friendly = (friendly & ~toBB) | fromBB;
+    board[from] = static_cast<uint8_t>(st.moved);
+    board[to] = NO_PIECE;
+
+    if (st.captured != -1) {
+        pieces[st.captured] |= toBB;
+        enemy |= toBB;
+        board[to] = static_cast<uint8_t>(st.captured);
     }
+    allOcc = wOcc | bOcc;
+    assert(isConsistent());
+}
 
-    // remove moving piece from origin
-    next.pieces[movingPieceIndex] &= ~(1ULL << m.from);
+// -----------------------------------------------------------------------------
+// Colour dispatch: the bodies above are templated on the side to move, Us, so
+// piece offsets, occupancies, pawn directions and promotion ranks are
+// compile-time constants. Each public method branches on side once.
+// -----------------------------------------------------------------------------
 
-    // remove captured enemy
-    for (int i = 0; i < 6; i++) {
-        if (next.pieces[enemyOffset + i] & (1ULL << m.to)) {
-            next.pieces[enemyOffset + i] &= ~(1ULL << m.to);
-            break;
-        }
-    }
+bool Position::is_in_check() const {
+    return side == 0 ? isInCheck<0>() : isInCheck<1>();
+}
 
-    // handle promotion: replace pawn with promoted piece
-    if (m.promotion != -1) {
-        if (side == 0) {
-            int promoted = 4;
-            switch (m.promotion) {
-                case 1: promoted = 1; break;
-                case 2: promoted = 2; break;
-                case 3: promoted = 3; break;
-                case 4: promoted = 4; break;
-                default: promoted = 4; break;
-            }
-            next.pieces[promoted] |= (1ULL << m.to);
-        } else {
-            int promoted = 10;
-            switch (m.promotion) {
-                case 1: promoted = 7; break;
-                case 2: promoted = 8; break;
-                case 3: promoted = 9; break;
-                case 4: promoted = 10; break;
-                default: promoted = 10; break;
-            }
-            next.pieces[promoted] |= (1ULL << m.to);
-        }
+CheckInfo Position::checkInfo() const {
+    return side == 0 ? checkInfo<0>() : checkInfo<1>();
+}
+
+Position::Bitboard Position::attackedBy(int color, Bitboard occ) const {
+    return color == 0 ? attackedBy<0>(occ) : attackedBy<1>(occ);
+}
+
+MoveList Position::genMoves() const {
+    return side == 0 ? genMoves<0, GenAll>() : genMoves<1, GenAll>();
+}
+
+MoveList Position::genCaptures() const {
+    return side == 0 ? genMoves<0, GenCaptures>() : genMoves<1, GenCaptures>();
+}
+
+MoveList Position::genQuiets() const {
+    return side == 0 ? genMoves<0, GenQuiets>() : genMoves<1, GenQuiets>();
+}
+
+bool Position::hasAnyLegalMove() const {
+    return side == 0 ? hasAnyLegalMove<0>() : hasAnyLegalMove<1>();
+}
+
+bool Position::isLegal(Move m) const {
+    return side == 0 ? isLegal<0>(m) : isLegal<1>(m);
+}
+
+void Position::doMove(Move m, StateInfo &st) {
+    if (side == 0) {
+        doMove<0>(m, st);
     } else {
-        next.pieces[movingPieceIndex] |= (1ULL << m.to);
+        doMove<1>(m, st);
     }
+}
 
-    // recompute occupancies
-    next.wOcc = next.pieces[0] | next.pieces[1] | next.pieces[2] |
-                next.pieces[3] | next.pieces[4] | next.pieces[5];
-    next.bOcc = next.pieces[6] | next.pieces[7] | next.pieces[8] |
-                next.pieces[9] | next.pieces[10] | next.pieces[11];
-    next.allOcc = next.wOcc | next.bOcc;
+// The side that made m is the one not to move now.
+void Position::undoMove(Move m, const StateInfo &st) {
+    if (side == 1) {
+        undoMove<0>(m, st);
+    } else {
+        undoMove<1>(m, st);
+    }
+}
 
-    // flip side
-    next.side = 1 - side;
+Position Position::makeMove(Move m) const {
+    Position next = *this;
+    StateInfo st;
+    next.doMove(m, st);
     return next;
 }
 
 std::string Position::to_string() const {
-    std::string board(64, '.');
-    const char *symbols = "PNBRQKpnbrqk";
-
-    for (int i = 0; i < 12; i++) {
-        Bitboard bb = pieces[i];
-        while (bb) {
-            int sq = __builtin_ctzll(bb);
-            bb &= bb - 1;
-            board[sq] = symbols[i];
-        }
-    }
+    const char *symbols = "PNBRQKpnbrqk.";
 
     std::string s;
     for (int rank = 7; rank >= 0; rank--) {
         for (int file = 0; file < 8; file++) {
-            s.push_back(board[rank * 8 + file]);
+            s.push_back(symbols[board[rank * 8 + file]]);
             s.push_back(' ');
         }
         s.push_back('\n');
@@ -575,23 +1214,28 @@ Position Position::fromFEN(const std::string &fen) {
         file++;
     }
 
-    pos.wOcc = pos.pieces[0] | pos.pieces[1] | pos.pieces[2] |
-               pos.pieces[3] | pos.pieces[4] | pos.pieces[5];
-    pos.bOcc = pos.pieces[6] | pos.pieces[7] | pos.pieces[8] |
-               pos.pieces[9] | pos.pieces[10] | pos.pieces[11];
-    pos.allOcc = pos.wOcc | pos.bOcc;
-
     pos.side = (activeColor == "w" ? 0 : 1);
-    return pos;
-}
 
-bool Position::is_threefold_repetition() const {
-    const uint64_t h = getZobristHash();
-    int count = 0;
-    for (uint64_t hh : gameHashes) {
-        if (hh == h) count++;
+    pos.castling = 0;
+    for (char c : castling) {
+        switch (c) {
+            case 'K': pos.castling |= WhiteOO; break;
+            case 'Q': pos.castling |= WhiteOOO; break;
+            case 'k': pos.castling |= BlackOO; break;
+            case 'q': pos.castling |= BlackOOO; break;
+            default: break;
+        }
+    }
+
+    pos.epSquare = -1;
+    if (enPassant.size() == 2 && enPassant[0] >= 'a' && enPassant[0] <= 'h' &&
+        (enPassant[1] == '3' || enPassant[1] == '6')) {
+        pos.epSquare = (enPassant[1] - '1') * 8 + (enPassant[0] - 'a');
     }
-    return count >= 3;
+
+    pos.rule50 = std::max(halfmove, 0);
+    pos.rebuildState();
+    return pos;
 }
 
 bool Position::isInsufficientMaterial() const {
@@ -636,13 +1280,14 @@ bool Position::isInsufficientMaterial() const {
 
     auto has_mating_material = [&](bool white) -> bool {
         const int N = white ? wN : bN;
+        const int B = white ? wB : bB;
         const uint64_t bishopsBB = white ? pieces[2] : pieces[8];
 
         // Bishop + Knight
-        if (N >= 1 && pop(bishopsBB) >= 1) return true;
+        if (N >= 1 && B >= 1) return true;
 
         // Two bishops on opposite colors
-        if (pop(bishopsBB) >= 2 && bishops_have_both_colors(bishopsBB)) return true;
+        if (B >= 2 && bishops_have_both_colors(bishopsBB)) return true;
 
         // Three knights can (in principle) deliver mate.
         if (N >= 3) return true;
@@ -0,0 +1,96 @@
+#include "tt.h"
+
+#include <algorithm>
+#include <cstring>
+
+TranspositionTable TT;
+
+// Packed slot layout: bits 0-31 value (float), 32-47 move, 48-55 depth,
+// 56-63 age of the search that wrote it.
+static uint64_t packData(double value, Move move, int depth, uint8_t age) {
+    const float v = static_cast<float>(value);
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return static_cast<uint64_t>(bits)
+         | (static_cast<uint64_t>(move.data) << 32)
+         | (static_cast<uint64_t>(std::clamp(depth, 0, 255)) << 48)
+         | (static_cast<uint64_t>(age) << 56);
+}
+
+static int dataDepth(uint64_t data) { return static_cast<int>((data >> 48) & 0xFF); }
+static uint8_t dataAge(uint64_t data) { return static_cast<uint8_t>(data >> 56); }
+
+void TranspositionTable::resize(size_t mb) {
+    const size_t count = std::max<size_t>(1, mb * 1024 * 1024 / sizeof(TTBucket));
+    if (count != bucketCount) {
+        buckets.reset(new TTBucket[count]);
+        bucketCount = count;
+    }
+    clear();
+}
+
+void TranspositionTable::clear() {
+    for (size_t i = 0; i < bucketCount; i++) {
+        for (TTEntry &e : buckets[i].entries) {
+            e.key.store(0, std::memory_order_relaxed);
+            e.data.store(0, std::memory_order_relaxed);
+        }
+    }
+    age = 0;
+}
+
+bool TranspositionTable::probe(uint64_t key, TTData &out) const {
+    const TTBucket &b = bucket(key);
+    for (const TTEntry &e : b.entries) {
+        const uint64_t data = e.data.load(std::memory_order_relaxed);
+        if ((e.key.load(std::memory_order_relaxed) ^ data) != key || data == 0) continue;
+
+        const uint32_t bits = static_cast<uint32_t>(data);
+        float v;
+        std::memcpy(&v, &bits, sizeof(v));
+        out.value = v;
+        out.move.data = static_cast<uint16_t>(data >> 32);
+        out.depth = dataDepth(data);
+        return true;
+    }
+    return false;
+}
+
+void TranspositionTable::store(uint64_t key, int depth, double value, Move move) {
+    TTBucket &b = bucket(key);
+
+    // Reuse the slot already holding this key; otherwise evict the slot
+    // with the lowest depth, treating each search of age as 8 plies.
+    TTEntry *victim = &b.entries[0];
+    int victimScore = 1 << 30;
+    for (TTEntry &e : b.entries) {
+        const uint64_t data = e.data.load(std::memory_order_relaxed);
+        if ((e.key.load(std::memory_order_relaxed) ^ data) == key) {
+            if (depth < dataDepth(data) && dataAge(data) == age) return;
+            victim = &e;
+            break;
+        }
+        const int relativeAge = static_cast<uint8_t>(age - dataAge(data));
+        const int score = (data == 0) ? -(1 << 30) : dataDepth(data) - 8 * relativeAge;
+        if (score < victimScore) {
+            victimScore = score;
+            victim = &e;
+        }
+    }
+
+    const uint64_t data = packData(value, move, depth, age);
+    victim->key.store(key ^ data, std::memory_order_relaxed);
+    victim->data.store(data, std::memory_order_relaxed);
+}
+
+int TranspositionTable::hashfull() const {
+    const size_t sample = std::min<size_t>(bucketCount, 250);
+    int used = 0;
+    for (size_t i = 0; i < sample; i++) {
+        for (const TTEntry &e : buckets[i].entries) {
+            const uint64_t data = e.data.load(std::memory_order_relaxed);
+            if (data != 0 && dataAge(data) == age) used++;
+        }
+    }
+    return static_cast<int>(used * 1000 / (sample * TTBucket::Size));
+}
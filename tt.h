@@ -0,0 +1,66 @@
+#ifndef TT_H
+#define TT_H
+
+#include "engine.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// -----------------------------------------------------------------------------
+// Transposition table shared by all search threads
+// -----------------------------------------------------------------------------
+
+// Decoded contents of a table slot.
+struct TTData {
+    double value; // softmax (SMTS) or bandit (MABS) value, side to move
+    Move move;    // move chosen at this node
+    int depth;
+};
+
+// One 16-byte slot. The key word holds hash ^ data, so an entry torn by a
+// concurrent write fails verification instead of returning mixed fields,
+// and no locking is needed.
+struct TTEntry {
+    std::atomic<uint64_t> key{0};
+    std::atomic<uint64_t> data{0};
+};
+
+// Four slots fill one cache line; a probe touches a single line.
+struct alignas(64) TTBucket {
+    static constexpr int Size = 4;
+    TTEntry entries[Size];
+};
+
+static_assert(sizeof(TTBucket) == 64, "TT bucket must be one cache line");
+
+class TranspositionTable {
+public:
+    static constexpr size_t DefaultMB = 16;
+    static constexpr size_t MaxMB = 65536;
+
+    // Must be called before the first probe; the UCI loop does so at startup.
+    void resize(size_t mb);
+    void clear();
+    void newSearch() { age = static_cast<uint8_t>(age + 1); }
+
+    bool probe(uint64_t key, TTData &out) const;
+    void store(uint64_t key, int depth, double value, Move move);
+
+    // Permille of sampled slots written during the current search.
+    int hashfull() const;
+
+private:
+    TTBucket &bucket(uint64_t key) const {
+        return buckets[static_cast<size_t>((static_cast<unsigned __int128>(key) * bucketCount) >> 64)];
+    }
+
+    std::unique_ptr<TTBucket[]> buckets;
+    size_t bucketCount = 0;
+    uint8_t age = 0;
+};
+
+extern TranspositionTable TT;
+
+#endif // TT_H